@@ -8,6 +8,7 @@
 #include "lib/manager.h"
 #include "lib/magic.h"
 #include "lib/utils.h"
+#include "lib/nnue.h"
 
 static inline int lsb(uint64_t x) {
   /* if (!x) {
@@ -42,6 +43,7 @@ board *init_board(void) {
   
   B->castle = WKS | WQS | BKS | BQS;
   B->cc = 0x0;
+  B->nnue = NULL;
 
   if (!B->WHITE || !B->BLACK) {
     fprintf(stderr, "Alloc failed\n");
@@ -110,6 +112,7 @@ board *preset_board(uint64_t wpawns, uint64_t bpawns, uint64_t wknights, uint64_
 
   B->castle = castling;
   B->cc = complete;
+  B->nnue = NULL;
 
   B->jumps = (uint64_t *)malloc(sizeof(uint64_t) * 64);
   if (!B->jumps) {
@@ -389,6 +392,7 @@ void free_board(board *B) {
   free(B->WHITE);
   free(B->BLACK);
   free (B->jumps);
+  nnue_detach(B);
   free(B);
 }
 
@@ -547,7 +551,7 @@ int movegen(board* B, int white, move_t** move_list, int check_legal) {
 
     int piece = piece_at(B, from);
     uint64_t from_mask = 1ULL << from;
-    uint64_t to_moves = imove(piece, from_mask, B, &white);
+    uint64_t to_moves = (piece == KING) ? (white ? wk_moves(from_mask, B->whites) : bk_moves(from_mask, B->blacks)) : imove(piece, from_mask, B, &white); // castles added below
     while (to_moves) {
       int to = lsb(to_moves);
       to_moves &= to_moves - 1;
@@ -592,12 +596,12 @@ int movegen(board* B, int white, move_t** move_list, int check_legal) {
       }
     }
   }
-  add_castles(B, white, move_list, &count, &max_moves);
+  add_castles(B, white, move_list, &count, &max_moves, NULL);
   // qsort_r(*move_list, count, sizeof(move_t), (void*)B, &mvvlva_comp);
   return count;
 }
 
-int movegen_ply(board* B, int white, int check_legal, int ply, move_t** out, move_t(*move_stack)[MAX_MOVES], int max_moves) {
+int movegen_ply(board* B, int white, int check_legal, int ply, move_t** out, move_t(*move_stack)[MAX_MOVES], int max_moves, const attack_info_t *ai) {
   move_t* list = move_stack[ply];
   int count = 0;
   uint64_t pieces = white ? B->whites : B->blacks;
@@ -608,7 +612,7 @@ int movegen_ply(board* B, int white, int check_legal, int ply, move_t** out, mov
 
     int piece = piece_at(B, from);
     uint64_t from_mask = 1ULL << from;
-    uint64_t to_moves = imove(piece, from_mask, B, &white);
+    uint64_t to_moves = (piece == KING) ? (white ? wk_moves(from_mask, B->whites) : bk_moves(from_mask, B->blacks)) : imove(piece, from_mask, B, &white); // castles added below
 
     while (to_moves && count < max_moves) {
       int to = lsb(to_moves);
@@ -660,7 +664,7 @@ int movegen_ply(board* B, int white, int check_legal, int ply, move_t** out, mov
     }
   }
 
-  add_castles_nalloc(B, white, list, &count, max_moves);
+  add_castles_nalloc(B, white, list, &count, max_moves, ai);
   *out = list;
   return count;
 }
@@ -692,6 +696,7 @@ board *clone(board *B) {
   clone->white = B->white;
   clone->whites = B->whites;
   clone->blacks = B->blacks;
+  clone->nnue = NULL; // accumulators are not shared
   return clone;
 }
 
@@ -854,6 +859,7 @@ void make_move(board* B, const move_t* m, int side, undo_t* u) {
   }
 
   fast_execute(B, m->piece, m->from, m->to, side, m->promo);
+  if (B->nnue) nnue_push(B, m, side, u);
 }
 
 void unmake_move(board* B, const move_t* m, int side, const undo_t* u) {
@@ -916,6 +922,7 @@ void unmake_move(board* B, const move_t* m, int side, const undo_t* u) {
 
   B->whites = whites(B);
   B->blacks = blacks(B);
+  if (B->nnue) nnue_pop(B);
 }
 
 uint64_t hash_board(const board* B) {
@@ -935,6 +942,37 @@ uint64_t hash_board(const board* B) {
   return hash;
 }
 
+static inline uint64_t zobrist(uint64_t i) { // splitmix64 of the feature index, a fixed Zobrist table without storing one
+  i += 0x9e3779b97f4a7c15ULL;
+  i = (i ^ (i >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  i = (i ^ (i >> 27)) * 0x94d049bb133111ebULL;
+  return i ^ (i >> 31);
+}
+
+int insufficient_material(const board *B) { // bare kings, or at most one minor each
+  if (B->WHITE[PAWN] | B->BLACK[PAWN] | B->WHITE[ROOK] | B->BLACK[ROOK] | B->WHITE[QUEEN] | B->BLACK[QUEEN]) return 0;
+  return __builtin_popcountll(B->WHITE[KNIGHT] | B->WHITE[BISHOP]) <= 1 && __builtin_popcountll(B->BLACK[KNIGHT] | B->BLACK[BISHOP]) <= 1;
+}
+
+uint64_t position_key(const board *B) { // same key in every build and process, for files on disk
+  uint64_t key = 0;
+  for (int pt = PAWN; pt <= KING; ++pt) {
+    uint64_t w = B->WHITE[pt], b = B->BLACK[pt];
+    while (w) {
+      key ^= zobrist((uint64_t)pt * 64 + __builtin_ctzll(w));
+      w &= w - 1;
+    }
+    while (b) {
+      key ^= zobrist((uint64_t)(NUM_PIECES + pt) * 64 + __builtin_ctzll(b));
+      b &= b - 1;
+    }
+  }
+  key ^= zobrist(768 + (B->castle & 0xF));
+  key ^= zobrist(784 + (B->cc & 0xF)); // castled flags change the eval
+  if (B->white) key ^= zobrist(800);
+  return key;
+}
+
 uint64_t hash_snapshot(const board_snapshot* S) {
   uint64_t hash = 0;
 
@@ -984,7 +1022,7 @@ int check(const board *B, int side) { // side puts opponent in check
   int ksq = lsb(k);
 
   // pawn
-  uint64_t atkP = side ? ((B->WHITE[PAWN] & ~FILE_A) << 9) | ((B->WHITE[PAWN] & ~FILE_H) << 7) : ((B->BLACK[PAWN] & ~FILE_H) >> 7) | ((B->BLACK[PAWN] & ~FILE_A) >> 9);
+  uint64_t atkP = side ? ((B->WHITE[PAWN] & ~FILE_H) << 9) | ((B->WHITE[PAWN] & ~FILE_A) << 7) : ((B->BLACK[PAWN] & ~FILE_H) >> 7) | ((B->BLACK[PAWN] & ~FILE_A) >> 9);
   if (atkP & (1ULL << ksq)) return 1;
 
   // knight
@@ -1054,65 +1092,64 @@ void load_position(board *B, const uint64_t *WHITE, const uint64_t *BLACK, int w
   assert(B->BLACK[KING] && !(B->BLACK[KING] & (B->BLACK[KING]-1)));
 }
 
-static inline uint64_t white_attacks(const board *B) {
+void compute_attacks(const board *B, attack_info_t *ai) {
   const uint64_t occ = B->whites | B->blacks;
-  uint64_t atk = 0ULL;
-
-  // pawn
-  uint64_t wp = B->WHITE[PAWN];
-  atk |= ((wp & ~FILE_A) << 9) | ((wp & ~FILE_H) << 7);
-
-  // knight
-  uint64_t n = B->WHITE[KNIGHT];
-  while (n) { int s = lsb(n); n &= n-1; atk |= B->jumps[s]; }
-
-  // diagonal
-  uint64_t bq = B->WHITE[BISHOP] | B->WHITE[QUEEN];
-  while (bq) { int s = lsb(bq); bq &= bq-1; atk |= generate_bishop_attacks(s, occ); }
-
-  // files/ranks
-  uint64_t rq = B->WHITE[ROOK] | B->WHITE[QUEEN];
-  while (rq) { int s = lsb(rq); rq &= rq-1; atk |= generate_rook_attacks(s, occ); }
-
-  // king
-  int ks = lsb(B->WHITE[KING]);
-  atk |= circle(ks);
 
-  return atk;
-}
-
-static inline uint64_t black_attacks(const board *B) {
-  const uint64_t occ = B->whites | B->blacks;
-  uint64_t atk = 0ULL;
-
-  // pawn
-  uint64_t bp = B->BLACK[PAWN];
-  atk |= ((bp & ~FILE_H) >> 7) | ((bp & ~FILE_A) >> 9);
-
-  // knights
-  uint64_t n = B->BLACK[KNIGHT];
-  while (n) { int s = lsb(n); n &= n-1; atk |= B->jumps[s]; }
-
-  // diagonal
-  uint64_t bq = B->BLACK[BISHOP] | B->BLACK[QUEEN];
-  while (bq) { int s = lsb(bq); bq &= bq-1; atk |= generate_bishop_attacks(s, occ); }
-
-  // files/ranks
-  uint64_t rq = B->BLACK[ROOK] | B->BLACK[QUEEN];
-  while (rq) { int s = lsb(rq); rq &= rq-1; atk |= generate_rook_attacks(s, occ); }
-
-  // king
-  int ks = lsb(B->BLACK[KING]);
-  atk |= circle(ks);
-
-  return atk;
+  for (int side = 0; side < 2; ++side) {
+    const uint64_t *P = side ? B->WHITE : B->BLACK;
+    const uint64_t own = side ? B->whites : B->blacks;
+    uint64_t *atk = ai->by_type[side];
+
+    // pawn
+    uint64_t p = P[PAWN];
+    atk[PAWN] = side ? ((p & ~FILE_H) << 9) | ((p & ~FILE_A) << 7) : ((p & ~FILE_H) >> 7) | ((p & ~FILE_A) >> 9);
+
+    // knight
+    uint64_t n = P[KNIGHT];
+    atk[KNIGHT] = 0ULL;
+    while (n) { int s = lsb(n); n &= n - 1; atk[KNIGHT] |= B->jumps[s]; }
+
+    // diagonal, queens kept apart for per piece maps
+    uint64_t b = P[BISHOP];
+    atk[BISHOP] = 0ULL;
+    while (b) { int s = lsb(b); b &= b - 1; atk[BISHOP] |= generate_bishop_attacks(s, occ); }
+
+    // files/ranks
+    uint64_t r = P[ROOK];
+    atk[ROOK] = 0ULL;
+    while (r) { int s = lsb(r); r &= r - 1; atk[ROOK] |= generate_rook_attacks(s, occ); }
+
+    uint64_t q = P[QUEEN];
+    atk[QUEEN] = 0ULL;
+    while (q) { int s = lsb(q); q &= q - 1; atk[QUEEN] |= generate_queen_attacks(s, occ); }
+
+    // king
+    int ks = lsb(P[KING]);
+    atk[KING] = circle(ks);
+    ai->king_zone[side] = atk[KING];
+
+    uint64_t pieces = atk[KNIGHT] | atk[BISHOP] | atk[ROOK] | atk[QUEEN] | atk[KING];
+    ai->all[side] = pieces | atk[PAWN];
+    ai->moves[side] = (pieces & ~own) | (side ? wp_moves(p, B->whites, B->blacks) : bp_moves(p, B->whites, B->blacks)); // same as white_moves/black_moves
+
+    // checkers, opposing pieces seen from the king square
+    const uint64_t *O = side ? B->BLACK : B->WHITE;
+    uint64_t kbb = P[KING];
+    uint64_t katk = side ? ((kbb & ~FILE_H) << 9) | ((kbb & ~FILE_A) << 7) : ((kbb & ~FILE_H) >> 7) | ((kbb & ~FILE_A) >> 9);
+    ai->checkers[side] = (katk & O[PAWN]) | (B->jumps[ks] & O[KNIGHT]) |
+                         (generate_bishop_attacks(ks, occ) & (O[BISHOP] | O[QUEEN])) |
+                         (generate_rook_attacks(ks, occ) & (O[ROOK] | O[QUEEN])) |
+                         (atk[KING] & O[KING]); // only after a pseudo-legal king move, makes it illegal
+  }
 }
 
-static inline void add_castles(board *B, int white, move_t **list, int *count, int *max_moves) {
+static inline void add_castles(board *B, int white, move_t **list, int *count, int *max_moves, const attack_info_t *ai) {
   const uint64_t occ = B->whites | B->blacks;
+  attack_info_t local;
   if (white) {
     if (!(B->WHITE[KING] & (1ULL << E1))) return; // king not on e1
-    const uint64_t opp = black_attacks(B);
+    if (!ai) { compute_attacks(B, &local); ai = &local; } // only when castling is possible
+    const uint64_t opp = ai->all[0];
     // white king side: e1 to g1
     if ((B->castle & WKS) && (B->WHITE[ROOK] & (1ULL << H1)) && /* rook on h1 */ !(occ & ((1ULL << F1) | (1ULL << G1))) && /* f1, g1 empty */ 
         !(opp & ((1ULL << E1) | (1ULL << F1) | (1ULL << G1)))) /* none attacked */ {
@@ -1136,7 +1173,8 @@ static inline void add_castles(board *B, int white, move_t **list, int *count, i
     }
   } else {
     if (!(B->BLACK[KING] & (1ULL << E8))) return; // king not on e8
-    const uint64_t opp = white_attacks(B);
+    if (!ai) { compute_attacks(B, &local); ai = &local; } // only when castling is possible
+    const uint64_t opp = ai->all[1];
 
     // black king side: e8 to g8
     if ((B->castle & BKS) && (B->BLACK[ROOK] & (1ULL << H8)) && !(occ & ((1ULL << F8) | (1ULL << G8))) &&
@@ -1162,12 +1200,14 @@ static inline void add_castles(board *B, int white, move_t **list, int *count, i
   }
 }
 
-static inline void add_castles_nalloc(board *B, int white, move_t *list, int *count, int max_moves) {
+static inline void add_castles_nalloc(board *B, int white, move_t *list, int *count, int max_moves, const attack_info_t *ai) {
   const uint64_t occ = B->whites | B->blacks;
+  attack_info_t local;
 
   if (white) {
     if (!(B->WHITE[KING] & (1ULL << E1))) return;
-    const uint64_t opp = black_attacks(B);
+    if (!ai) { compute_attacks(B, &local); ai = &local; } // only when castling is possible
+    const uint64_t opp = ai->all[0];
 
     // white king side
     if ((B->castle & WKS) &&
@@ -1192,7 +1232,8 @@ static inline void add_castles_nalloc(board *B, int white, move_t *list, int *co
     }
   } else {
     if (!(B->BLACK[KING] & (1ULL << E8))) return;
-    const uint64_t opp = white_attacks(B);
+    if (!ai) { compute_attacks(B, &local); ai = &local; } // only when castling is possible
+    const uint64_t opp = ai->all[1];
 
     // black king side
     if ((B->castle & BKS) &&
@@ -1218,24 +1259,6 @@ static inline void add_castles_nalloc(board *B, int white, move_t *list, int *co
   }
 }
 
-int square_attacker(const board *B_in, int square, int by_black) {
-  board B = *B_in;
-  board_snapshot S; save_snapshot(B_in, &S);
-  if (by_black) {
-    B.WHITE[KING] = (1ULL << square);
-    B.whites = whites(&B);
-    int attacked = check(&B, 0); // test white king
-    restore_snapshot((board*)B_in, &S);
-    return attacked;
-  } else {
-    B.BLACK[KING] = (1ULL << square);
-    B.blacks = blacks(&B);
-    int attacked = check(&B, 1); // test black king
-    restore_snapshot((board*)B_in, &S);
-    return attacked;
-  }
-}
-
 void apply_promotion(board *B, int side, int to, int newp) {
   uint64_t to_mask = 1ULL << to;
 
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <math.h>
 #include <time.h>
 #include "lib/bot.h"
 #include "lib/board.h"
@@ -11,16 +12,23 @@
 #include "lib/utils.h"
 #include "lib/tt.h"
 #include "lib/see.h"
-
-move_t pv_table[MAX_PLY][MAX_PLY];
-int pv_length[MAX_PLY];
-move_t best_pv[MAX_PLY];
-int best_pv_len = 0;
-
-move_t move_stack[MAX_PLY][MAX_MOVES];
-move_t qmove_stack[MAX_QPLY][MAX_MOVES];
-move_t last_move[MAX_PLY];
-move_t counter_move[2][64][64]; // best reply side, from, to
+#include "lib/magic.h"
+#include "lib/nnue.h"
+#include "lib/experience.h"
+#include "lib/opening.h"
+
+// search state is per thread, so concurrent games each have their own
+_Thread_local move_t pv_table[MAX_PLY][MAX_PLY];
+_Thread_local int pv_length[MAX_PLY];
+_Thread_local move_t best_pv[MAX_PLY];
+_Thread_local int best_pv_len = 0;
+
+_Thread_local move_t move_stack[MAX_PLY][MAX_MOVES];
+_Thread_local move_t qmove_stack[MAX_QPLY][MAX_MOVES];
+_Thread_local move_t last_move[MAX_PLY];
+_Thread_local move_t counter_move[2][64][64]; // best reply side, from, to
+static _Thread_local uint64_t book_rng; // book picks at the root, per game thread
+static _Thread_local search_hist_t thread_hist; // history when no search_ctx_t is in use
 
 static const int PIECE_PT[64] = {
   -1, /*1*/ PAWN, /*2*/ KNIGHT, -1, /*4*/ BISHOP, -1, -1, -1, /*8*/ ROOK, -1, -1, -1, -1, -1, -1, -1,
@@ -48,13 +56,61 @@ static void init_ordering_tables(void) {
       for (int t = 0; t < 64; ++t)
         counter_move[s][f][t].from = 255; // empty
 
-  memset(history_tbl, 0, sizeof(history_tbl));
+  if (!hist) hist = &thread_hist;
+  int *h = &hist->quiet[0][0][0]; // age instead of wiping, earlier searches still order the next one
+  for (size_t k = 0; k < sizeof(hist->quiet) / sizeof(*h); ++k)
+    h[k] /= 2;
+  h = &hist->capt[0][0][0][0];
+  for (size_t k = 0; k < sizeof(hist->capt) / sizeof(*h); ++k)
+    h[k] /= 2;
+  int16_t *c = &hist->cont[0][0][0][0][0][0];
+  for (size_t k = 0; k < sizeof(hist->cont) / sizeof(*c); ++k)
+    c[k] /= 2;
+  init_lmr_table();
+}
+
+static void init_lmr_table(void) { // once per search thread
+  static _Thread_local int ready = 0;
+  if (ready) return;
+  for (int d = 1; d < LMR_TABLE_SIZE; ++d)
+    for (int m = 1; m < LMR_TABLE_SIZE; ++m)
+      lmr_table[d][m] = (int)(log(d) * log(m) / LMR_DIVISOR);
+  ready = 1;
+}
+
+static inline int gravity(int v, int bonus) { // saturates towards +-HISTORY_MAX
+  return v + bonus - v * abs(bonus) / HISTORY_MAX;
+}
+
+static inline int quiet_history(int side, int ply, const move_t *m) { // butterfly plus the follow up tables
+  int h = hist->quiet[side][m->piece][m->to];
+  for (int back = 1; back <= 2 && back <= ply; ++back) {
+    move_t prev = last_move[ply - back];
+    if (prev.from != 255) h += hist->cont[back - 1][side][prev.piece][prev.to][m->piece][m->to];
+  }
+  return h;
+}
+
+static void update_quiet_history(int side, int ply, const move_t *m, int bonus) {
+  int *h = &hist->quiet[side][m->piece][m->to];
+  *h = gravity(*h, bonus);
+  for (int back = 1; back <= 2 && back <= ply; ++back) {
+    move_t prev = last_move[ply - back];
+    if (prev.from == 255) continue; // null move or none
+    int16_t *c = &hist->cont[back - 1][side][prev.piece][prev.to][m->piece][m->to];
+    *c = (int16_t)gravity(*c, bonus);
+  }
+}
+
+static inline int *capture_history(const board *B, int side, const move_t *m) { // entry of a capture on this board
+  int vic = victim_square(B, side, m->to);
+  return &hist->capt[side][m->piece][m->to][vic >= 0 ? vic : PAWN];
 }
 
 static inline int time_over(void) {
   if (time_flag) return 1;
   if ((nodes & NODE_CHECK) != 0) return 0;
-  if (gtime() >= deadline) {
+  if (gtime() >= deadline || (node_budget && search_nodes + nodes >= node_budget)) {
     time_flag = 1;
     return 1;
   }
@@ -70,22 +126,28 @@ bot *init_bot(board *B, int white, int depth, int limit) {
   player->white = white;
   player->depth = depth;
   player->limit = limit;
+  player->node_limit = 0;
+  player->quiet = 0;
+  player->use_book = 1;
+  player->score = 0;
   return player;
 }
 
-double gtime(void) {
-  return (double)clock() / CLOCKS_PER_SEC;
+double gtime(void) { // wall clock, CPU time would count every game thread
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int ply) {
+int minimax(board *B, const attack_info_t *ai, int depth, int max, int alpha, int beta, long *info, int ply, int cut_node) {
 #ifdef DEBUG
   *info += 1;
   *(info + 1) += (depth == 0) ? 1 : 0;
 #endif
   ++nodes;
   pv_length[ply] = 0;
-  if (ply >= MAX_PLY) return blended_eval(B);
-  if (time_over()) return blended_eval(B);
+  if (ply >= MAX_PLY) return evaluate(B, ai);
+  if (time_over()) return evaluate(B, ai);
   int old = B->white;
   B->white = max;
 
@@ -93,48 +155,66 @@ int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int p
   uint16_t tt_move = 0;
   int tt_score = 0;
   int orig_alpha = alpha;
+  uint16_t excluded = sstack[ply].excluded; // singular search, its results are not stored
 
-  if (TT_ENABLED && g_tt) {
-    hash = hash_board(B);
+  if (TT_ENABLED && g_tt && !excluded) {
+    hash = sstack[ply].hash ? sstack[ply].hash : hash_board(B);
     if (tt_probe(g_tt, hash, depth, alpha, beta, &tt_score, &tt_move, ply)) {
       B->white = old; // TT hit
       return tt_score;
     }
+    int qeval;
+    uint16_t qmove = 0; // only qtt_probe fills it, skipped above QTT_MAX_DEPTH
+    if (depth <= QTT_MAX_DEPTH && !(depth == 0 && ai->checkers[max]) && qtt_probe(g_qtt, hash, depth, alpha, beta, &tt_score, &qmove, &qeval, ply)) {
+      B->white = old; // shallow results only live in the qtt, in check depth 0 is oneply_check not quiesce
+      return tt_score;
+    }
+    if (!tt_move) tt_move = qmove;
   }
 
   if (depth == 0) {
-    int ch = check(B, !max);
-    if (ch) {
-      int v = oneply_check(B, max, alpha, beta, info, ply);
+    if (ai->checkers[max]) { // side to move in check
+      int v = oneply_check(B, ai, max, alpha, beta, info, ply);
       B->white = old;
       return v;
     }
 
-    int v = ROOT_QUIESCENCE_ENABLED ? quiesce(B, max, alpha, beta, info, 0) : blended_eval(B);
+    int v = ROOT_QUIESCENCE_ENABLED ? quiesce(B, ai, max, alpha, beta, info, ply, 0) : evaluate(B, ai);
     B->white = old;
     return v;
   }
 
-  int in_check = check(B, !max);
+  int in_check = ai->checkers[max] != 0;
   int pv_node = WINDOW_IS_PV(alpha, beta);
   int near_root = (ply <= 2);
-  int stand_eval = 0;
-  int have_stand = 0;
+  int stand_eval = in_check ? NO_EVAL : evaluate(B, ai); // kept for the improving signal
   const int MATE_BOUND = MATE - 2 * QUEEN_VALUE; // near mate bound
 
-  if (NMP_ENABLED && !pv_node && !near_root && !in_check && depth >= NMP_MIN_DEPTH && ply > 0) {
-    if (!have_stand) {
-      stand_eval = blended_eval(B);
-      have_stand = 1;
+  sstack[ply].static_eval = stand_eval;
+  int improving = 0; // static eval better for the side to move than at its last turn
+  if (!in_check) {
+    int prev = ply >= 2 ? sstack[ply - 2].static_eval : NO_EVAL;
+    if (prev == NO_EVAL && ply >= 4) prev = sstack[ply - 4].static_eval;
+    improving = prev == NO_EVAL || (max ? stand_eval > prev : stand_eval < prev);
+  }
+
+  if (RFP_ENABLED && !pv_node && !near_root && !in_check && !excluded && depth <= PARAM(RFP_MAX_DEPTH) && abs(stand_eval) < MATE_BOUND) {
+    int margin = PARAM(RFP_MARGIN) * (depth - improving); // trust an improving eval more
+    if (max ? stand_eval - margin >= beta : stand_eval + margin <= alpha) {
+      B->white = old;
+      return stand_eval;
     }
+  }
 
-    if (abs(stand_eval) < MATE_BOUND && ((max && stand_eval >= beta - NMP_MARGIN) || (!max && stand_eval <= alpha + NMP_MARGIN))) { // avoid mate positions
-      int R = NMP_BASE_REDUCTION + NMP_EXTRA_REDUCTION(depth);
+  if (NMP_ENABLED && !pv_node && !near_root && !in_check && !excluded && depth >= PARAM(NMP_MIN_DEPTH) && ply > 0) {
+    if (abs(stand_eval) < MATE_BOUND && ((max && stand_eval >= beta - PARAM(NMP_MARGIN)) || (!max && stand_eval <= alpha + PARAM(NMP_MARGIN)))) { // avoid mate positions
+      int R = PARAM(NMP_BASE_REDUCTION) + NMP_EXTRA_REDUCTION(depth);
       int nmdepth = depth - 1 - R;
       if (nmdepth < 0) nmdepth = 0;
 
       B->white = !max; // give side to opp
-      int nmeval = minimax(B, nmdepth, !max, alpha, beta, info, ply + 1);
+      last_move[ply].from = 255; // no follow up history through a null move
+      int nmeval = minimax(B, ai, nmdepth, !max, alpha, beta, info, ply + 1, !cut_node); // same position, same attacks
       B->white = max;
 
       if (max) {
@@ -151,17 +231,12 @@ int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int p
     }
   }
 
-  if (RAZOR_ENABLED && !pv_node && !near_root && !in_check && depth <= RAZOR_MAX_DEPTH && ply > 0) { // not at root
-    if (!have_stand) {
-      stand_eval = blended_eval(B);
-      have_stand = 1;
-    }
-
+  if (RAZOR_ENABLED && !pv_node && !near_root && !in_check && !excluded && depth <= PARAM(RAZOR_MAX_DEPTH) && ply > 0) { // not at root
     if (abs(stand_eval) < MATE_BOUND) { // avoid mate positions
-      int margin1 = RAZOR_MARGIN1; // first stage razor, quiesce
+      int margin1 = PARAM(RAZOR_MARGIN1); // first stage razor, quiesce
       if (max) {
         if (stand_eval + margin1 <= alpha) {
-          int q = quiesce(B, max, alpha, beta, info, 0);
+          int q = quiesce(B, ai, max, alpha, beta, info, ply, 0);
           if (q <= alpha) {
             B->white = old;
             return q;
@@ -169,7 +244,7 @@ int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int p
         }
       } else {
         if (stand_eval - margin1 >= beta) {
-          int q = quiesce(B, max, alpha, beta, info, 0);
+          int q = quiesce(B, ai, max, alpha, beta, info, ply, 0);
           if (q >= beta) {
             B->white = old;
             return q;
@@ -178,10 +253,10 @@ int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int p
       }
 
       if (depth == 2) { // second stage razor, reduced search
-        int margin2 = RAZOR_MARGIN2;
+        int margin2 = PARAM(RAZOR_MARGIN2);
         if (max) {
           if (stand_eval + margin2 <= alpha) {
-            int r = minimax(B, depth - 1, max, alpha, beta, info, ply);
+            int r = minimax(B, ai, depth - 1, max, alpha, beta, info, ply, cut_node);
             if (r <= alpha) {
               B->white = old;
               return r;
@@ -189,7 +264,7 @@ int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int p
           }
         } else {
           if (stand_eval - margin2 >= beta) {
-            int r = minimax(B, depth - 1, max, alpha, beta, info, ply);
+            int r = minimax(B, ai, depth - 1, max, alpha, beta, info, ply, cut_node);
             if (r >= beta) {
               B->white = old;
               return r;
@@ -200,14 +275,9 @@ int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int p
     }
   }
 
-  if (FUT_ENABLED && !pv_node && !in_check && depth <= FUT_NODE_MAX_DEPTH && ply > 0) { // shallow, not check
-    if (!have_stand) {
-      stand_eval = blended_eval(B);
-      have_stand = 1;
-    }
-
+  if (FUT_ENABLED && !pv_node && !in_check && depth <= PARAM(FUT_NODE_MAX_DEPTH) && ply > 0) { // shallow, not check
     if (abs(stand_eval) < MATE_BOUND) { // avoid mate positions
-      int margin = FUT_BASE_MARGIN * depth;
+      int margin = PARAM(FUT_BASE_MARGIN) * depth;
       if (max) {
         if (stand_eval + margin <= alpha) { // static + margin <= alpha: fail low
           B->white = old;
@@ -222,43 +292,116 @@ int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int p
     }
   }
 
+  STAT(int t = pv_node ? 0 : cut_node ? 1 : 2; stats.tt_nodes[t]++; stats.tt_missing[t] += !tt_move);
+  if (!tt_move && !excluded) { // no hash move, the move ordering is a guess
+    if (IID_ENABLED && pv_node && depth >= IID_MIN_DEPTH) {
+      minimax(B, ai, depth - IID_REDUCTION, max, alpha, beta, info, ply, cut_node);
+      tt_move = TT_ENABLED ? tt_get_move(g_tt, hash) : 0;
+      if (TT_ENABLED && !tt_move) tt_move = qtt_get_move(g_qtt, hash); // reduced depth at or under QTT_MAX_DEPTH
+    } else if (IIR_ENABLED && (pv_node || cut_node) && depth >= IIR_MIN_DEPTH) {
+      depth--; // cheaper search now, the TT move is there next iteration
+    }
+  }
+
   int best = max ? INT32_MIN : INT32_MAX;
   move_t best_move = { .from = 255, .to = 255, .piece = 255, .promo = 0 };
+  int singular = 0; // every alternative to the TT move fails low, extend it
+  if (SE_ENABLED && tt_move && !excluded && ply > 0 && ply < 2 * root_depth && depth >= PARAM(SE_MIN_DEPTH)) {
+    int se_score, se_depth;
+    tt_flag_t se_flag;
+    if (tt_lookup(g_tt, hash, &se_score, &se_depth, &se_flag, ply) && se_depth >= depth - SE_TT_DEPTH && abs(se_score) < MATE_BOUND &&
+        (se_flag == TT_EXACT || se_flag == (max ? TT_LOWER : TT_UPPER))) { // the TT move cut here before
+      int sbeta = max ? se_score - PARAM(SE_MARGIN) * depth : se_score + PARAM(SE_MARGIN) * depth;
+      sstack[ply].excluded = tt_move;
+      int s = max ? minimax(B, ai, (depth - 1) / 2, max, sbeta - 1, sbeta, info, ply, cut_node)
+                  : minimax(B, ai, (depth - 1) / 2, max, sbeta, sbeta + 1, info, ply, cut_node);
+      sstack[ply].excluded = 0;
+      STAT(stats.se_tried++);
+      if (max ? s < sbeta : s > sbeta) {
+        singular = 1;
+        STAT(stats.se_extended++);
+      } else if (!pv_node && cut_node && (max ? sbeta >= beta : sbeta <= alpha)) { // an alternative beats beta too, multi-cut
+        STAT(stats.se_multi_cut++);
+        B->white = old;
+        return sbeta;
+      }
+    }
+  }
+
+  move_t quiets[MAX_QUIETS]; // searched without a cutoff
+  int quiet_count = 0;
+  move_t captures[MAX_CAPTURES];
+  int capture_count = 0;
   move_t *moves;
-  int move_count = movegen_ply(B, max, 1, ply, &moves, move_stack, MAX_MOVES);
+  int move_count = movegen_ply(B, max, 1, ply, &moves, move_stack, MAX_MOVES, ai);
   if (move_count == 0) {
-    int in_mate = check(B, !max); // opponent attacking side to move
-    int v = in_mate ? (max ? -MATE + ply : +MATE - ply) : 0;
+    int v = in_check ? (max ? -MATE + ply : +MATE - ply) : 0;
     B->white = old;
     return v;
   }
   score_moves(B, moves, move_count, max, ply, tt_move);
 
-  if (FUT_ENABLED && !pv_node && !in_check && depth <= FUT_MOVE_MAX_DEPTH && ply > 0 && !have_stand) {
-    stand_eval = blended_eval(B);
-    have_stand = 1;
+  if (PROBCUT_ENABLED && !pv_node && !in_check && !excluded && depth >= PARAM(PROBCUT_MIN_DEPTH) && beta < MATE_BOUND && alpha > -MATE_BOUND) {
+    int pbound = max ? beta + PARAM(PROBCUT_MARGIN) : alpha - PARAM(PROBCUT_MARGIN); // bound the capture has to beat
+    int pdepth = depth - PROBCUT_REDUCTION;
+    if (pdepth < 0) pdepth = 0;
+    for (int k = 0; k < move_count; ++k) {
+      if (!is_capture(B, max, &moves[k]) || !see_ge(B, &moves[k], max, max ? pbound - stand_eval : stand_eval - pbound)) continue;
+      undo_t u;
+      make_move(B, &moves[k], max, &u);
+      last_move[ply] = moves[k];
+      attack_info_t child;
+      compute_attacks(B, &child);
+      STAT(stats.probcut_tried++);
+      B->white = !max;
+      int v = max ? quiesce(B, &child, 0, pbound - 1, pbound, info, ply + 1, 0) : quiesce(B, &child, 1, pbound, pbound + 1, info, ply + 1, 0);
+      B->white = max;
+      if (pdepth > 0 && (max ? v >= pbound : v <= pbound)) // capture holds statically, confirm it at reduced depth
+        v = max ? minimax(B, &child, pdepth, 0, pbound - 1, pbound, info, ply + 1, !cut_node)
+                : minimax(B, &child, pdepth, 1, pbound, pbound + 1, info, ply + 1, !cut_node);
+      unmake_move(B, &moves[k], max, &u);
+      if (max ? v >= pbound : v <= pbound) {
+        STAT(stats.probcut_cut++);
+        if (TT_ENABLED && g_tt) {
+          uint16_t encoded = tt_encode_move(moves[k].from, moves[k].to, moves[k].promo);
+          tt_flag_t flag = max ? TT_LOWER : TT_UPPER;
+          if (pdepth + 1 <= QTT_MAX_DEPTH) qtt_store(g_qtt, hash, pdepth + 1, v, flag, encoded, QTT_NO_EVAL, ply);
+          else tt_store(g_tt, hash, pdepth + 1, v, flag, encoded, ply);
+        }
+        B->white = old;
+        return v;
+      }
+    }
   }
 
   int i;
   for (i = 0; i < move_count; ++i) {
     undo_t u;
     int cap = is_capture(B, max, &moves[i]);
+    uint16_t encoded_move = tt_encode_move(moves[i].from, moves[i].to, moves[i].promo);
+    if (excluded && encoded_move == excluded) continue;
+    int is_tt_move = tt_move && encoded_move == tt_move;
 
     // SEE pruning for bad captures, low depths, no PV, prunes losing captures
-    if (cap && !pv_node && !in_check && depth <= SEE_PRUNE_DEPTH && ply > 0 && i > 0) {
+    if (cap && !pv_node && !in_check && depth <= PARAM(SEE_PRUNE_DEPTH) && ply > 0 && i > 0) {
       // if SEE < -margin * depth prune
-      int see_threshold = -SEE_PRUNE_MARGIN * depth;
+      int see_threshold = -PARAM(SEE_PRUNE_MARGIN) * depth - *capture_history(B, max, &moves[i]) / CAPT_HIST_SEE_DIV; // captures that kept cutting get slack
       if (!see_ge(B, &moves[i], max, see_threshold)) {
         continue; // bad capture, prune
       }
     }
 
-    if (LMP_ENABLED && !pv_node && !near_root && !in_check && !cap && depth <= LMP_MAX_DEPTH && ply > 0 && i >= LMP_SKIP_BASE + depth) { // not check, not root
+    if (LMP_ENABLED && !pv_node && !near_root && !in_check && !cap && depth <= PARAM(LMP_MAX_DEPTH) && ply > 0 && i >= PARAM(LMP_SKIP_BASE) + depth) { // not check, not root
       continue; // prune
     }
 
-    if (FUT_ENABLED && !pv_node && !in_check && depth <= FUT_MOVE_MAX_DEPTH && !cap && ply > 0 && i > 0 && have_stand && abs(stand_eval) < MATE_BOUND) { // not at root, not first move
-      int margin = FUT_MOVE_MARGIN * depth; // move futility pruning
+    if (HIST_PRUNE_ENABLED && !pv_node && !in_check && !cap && depth <= PARAM(HIST_PRUNE_DEPTH) && i > 0 && !moves[i].promo &&
+        !equals(killer1[ply], moves[i]) && !equals(killer2[ply], moves[i]) && quiet_history(max, ply, &moves[i]) < -PARAM(HIST_PRUNE_MARGIN) * depth) {
+      continue; // kept failing to cut here
+    }
+
+    if (FUT_ENABLED && !pv_node && !in_check && depth <= PARAM(FUT_MOVE_MAX_DEPTH) && !cap && ply > 0 && i > 0 && abs(stand_eval) < MATE_BOUND) { // not at root, not first move
+      int margin = PARAM(FUT_MOVE_MARGIN) * depth; // move futility pruning
       if (max) {
         if (stand_eval + margin <= alpha) {
           continue;
@@ -273,61 +416,59 @@ int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int p
     int is_good_capture = cap && see_ge(B, &moves[i], max, 0); // good capture if SEE >= 0
 
     make_move(B, &moves[i], max, &u);
+    if (TT_ENABLED && g_tt && ply + 1 < MAX_PLY) { // the child's own hash, prefetched here and probed there without rehashing
+      B->white = !max;
+      sstack[ply + 1].hash = hash_board(B);
+      B->white = max;
+      tt_prefetch(g_tt, sstack[ply + 1].hash);
+    }
     last_move[ply] = moves[i]; // last move
-    int gives_check = check(B, max);
+    attack_info_t child; // computed once here, reused by the child node
+    compute_attacks(B, &child);
+    int gives_check = child.checkers[!max] != 0;
 
     // extend ply when move gives check
     int extension = 0;
     if (CHECK_EXTENSION_ENABLED && gives_check) {
       extension = CHECK_EXTENSION;
     }
+    if (singular && is_tt_move && extension < SE_EXTENSION) extension = SE_EXTENSION;
 
     int new_depth = depth - 1 + extension;
     int eval;
-    int lmr = 0;
-
-    if (LMR_ENABLED && !pv_node && depth >= LMR_MIN_DEPTH && ply > 0 && i >= 1 && !is_good_capture && !gives_check && !in_check) {
-      int R = LMR_BASE_REDUCTION;
-
-      // move scaling
-      if (depth >= 5) R++;
-      if (i >= 8) R++;
-      if (R > new_depth) R = new_depth;
-      int red_depth = new_depth - R;
-      if (red_depth < 1) red_depth = 1;
-      lmr = 1;
-      int nalpha = alpha; // reduced search window
-      int nbeta = alpha + 1;
-      if (!max) {
-        nbeta = beta;
-        nalpha = beta - 1;
-      }
-
-      eval = minimax(B, red_depth, !max, nalpha, nbeta, info, ply + 1);
-
-      if (max ? (eval > alpha) : (eval < beta)) { // re-search full window
-        eval = minimax(B, new_depth, !max, alpha, beta, info, ply + 1);
+    int nalpha = max ? alpha : beta - 1; // null window on the bound this side must beat
+    int nbeta = max ? alpha + 1 : beta;
+    int R = 0;
+
+    if (LMR_ENABLED && depth >= PARAM(LMR_MIN_DEPTH) && ply > 0 && i >= 1 && !is_good_capture && !gives_check && !in_check) {
+      int d = depth < LMR_TABLE_SIZE ? depth : LMR_TABLE_SIZE - 1;
+      int m = i + 1 < LMR_TABLE_SIZE ? i + 1 : LMR_TABLE_SIZE - 1;
+      R = PARAM(LMR_BASE_REDUCTION) + lmr_table[d][m];
+      if (pv_node) R--;
+      if (cut_node) R++;
+      if (!improving) R++;
+      if (!cap) { // well ordered quiets lose less depth
+        int hist = quiet_history(max, ply, &moves[i]) / LMR_HISTORY_DIV;
+        R -= hist > 2 ? 2 : hist < -2 ? -2 : hist;
+        if (equals(killer1[ply], moves[i]) || equals(killer2[ply], moves[i])) R--;
       }
-    } else {
-      if (!PVS_ENABLED || i == 0) {
-        eval = minimax(B, new_depth, !max, alpha, beta, info, ply + 1);
-      } else {
-        int pvs_alpha = alpha; // null window
-        int pvs_beta  = alpha + 1;
-        if (!max) {
-          pvs_beta  = beta;
-          pvs_alpha = beta - 1;
-        }
-
-        eval = minimax(B, new_depth, !max, pvs_alpha, pvs_beta, info, ply + 1);
+      if (R > new_depth - 1) R = new_depth - 1; // at least depth 1
+    }
 
-        if (max ? (eval > alpha && eval < beta) : (eval < beta && eval > alpha)) {
-          eval = minimax(B, new_depth, !max, alpha, beta, info, ply + 1);
-        }
-      }
+    if (R > 0) {
+      eval = minimax(B, &child, new_depth - R, !max, nalpha, nbeta, info, ply + 1, 1);
+      int raised = max ? eval > alpha : eval < beta;
+      STAT(int b = R < LMR_STAT_BUCKETS ? R - 1 : LMR_STAT_BUCKETS - 1; stats.lmr_tried[b]++; stats.lmr_research[b] += raised);
+      if (raised) eval = minimax(B, &child, new_depth, !max, nalpha, nbeta, info, ply + 1, !cut_node);
+    } else if (!pv_node || (PVS_ENABLED && i > 0)) {
+      eval = minimax(B, &child, new_depth, !max, nalpha, nbeta, info, ply + 1, !cut_node);
+    }
+    if (pv_node && (i == 0 || !PVS_ENABLED || (max ? (eval > alpha && eval < beta) : (eval < beta && eval > alpha)))) {
+      eval = minimax(B, &child, new_depth, !max, alpha, beta, info, ply + 1, 0); // PV, full window
     }
 
     unmake_move(B, &moves[i], max, &u);
+    if (ply + 1 < MAX_PLY) sstack[ply + 1].hash = 0; // null move and ProbCut children hash themselves
     int better = (max ? (eval > best) : (eval < best));
 
     if (better) {
@@ -349,12 +490,23 @@ int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int p
     }
 
     if (beta <= alpha) {
+      int bonus = HISTORY_BONUS(depth);
+      if (cap) {
+        int *ch = capture_history(B, max, &moves[i]);
+        *ch = gravity(*ch, bonus);
+      }
+      for (int q = 0; q < capture_count; ++q) { // earlier captures failed to cut
+        int *ch = capture_history(B, max, &captures[q]);
+        *ch = gravity(*ch, -bonus);
+      }
       if (!cap) { // update killers, history, countermove for quiet moves
         if (!equals(killer1[ply], moves[i])) {
           killer2[ply] = killer1[ply];
           killer1[ply] = moves[i];
         }
-        history_tbl[max][moves[i].piece][moves[i].to] += depth * depth;
+        update_quiet_history(max, ply, &moves[i], bonus);
+        for (int q = 0; q < quiet_count; ++q) // earlier quiets failed to cut
+          update_quiet_history(max, ply, &quiets[q], -bonus);
 
         if (ply > 0) {
           move_t prev = last_move[ply - 1]; // move before this node
@@ -367,9 +519,11 @@ int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int p
       best_move = moves[i];  // cutoff move is best for TT
       break;
     }
+    if (!cap && quiet_count < MAX_QUIETS) quiets[quiet_count++] = moves[i];
+    else if (cap && capture_count < MAX_CAPTURES) captures[capture_count++] = moves[i];
   }
 
-  if (TT_ENABLED && g_tt && best_move.from != 255) { // store TT
+  if (TT_ENABLED && g_tt && best_move.from != 255 && !excluded) { // store TT
     tt_flag_t flag;
     if (best <= orig_alpha) {
       flag = TT_UPPER;  // fail-low higher bound
@@ -379,38 +533,73 @@ int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int p
       flag = TT_EXACT;  // PV node exact score
     }
     uint16_t encoded = tt_encode_move(best_move.from, best_move.to, best_move.promo);
-    tt_store(g_tt, hash, depth, best, flag, encoded, ply);
+    if (depth <= QTT_MAX_DEPTH) qtt_store(g_qtt, hash, depth, best, flag, encoded, QTT_NO_EVAL, ply); // keep g_tt for deep entries
+    else tt_store(g_tt, hash, depth, best, flag, encoded, ply);
   }
 
   B->white = old;
   return best;
 }
 
-int quiesce(board* B, int side, int alpha, int beta, long* info, int qply) {
+int quiesce(board* B, const attack_info_t *ai, int side, int alpha, int beta, long* info, int ply, int qply) {
 #ifdef DEBUG
   * (info + 2) += 1;
 #endif
-  if (time_over()) return blended_eval(B);
-
-  if (qply >= MAX_QPLY)
-    return blended_eval(B);
+  if (time_over()) return evaluate(B, ai);
+
+  if (qply >= MAX_QPLY || ply >= MAX_PLY)
+    return evaluate(B, ai);
+
+  int in_check = ai->checkers[side] != 0;
+  int qdepth = qply == 0 ? 0 : -1; // first ply also tries quiet checks, worth more than the capture only plies
+  uint64_t hash = 0;
+  uint16_t qtt_move = 0;
+  int qtt_eval = QTT_NO_EVAL;
+  int orig_alpha = alpha, orig_beta = beta;
+  if (TT_ENABLED && g_qtt) { // stand pat and best move reuse
+    int qtt_score;
+    hash = hash_board(B);
+    if (qtt_probe(g_qtt, hash, qdepth, alpha, beta, &qtt_score, &qtt_move, &qtt_eval, ply))
+      return qtt_score;
+  }
 
   // 1 = white (max), 0 = black (min)
-  int stand = blended_eval(B);
-  if (side) { // max
-    if (stand >= beta)  return beta;
-    if (stand > alpha)  alpha = stand;
-  } else { // min
-    if (stand <= alpha) return alpha;
-    if (stand < beta)   beta = stand;
+  int stand = QTT_NO_EVAL; // in check every evasion is searched instead of standing pat
+  if (!in_check) {
+    stand = qtt_eval != QTT_NO_EVAL ? qtt_eval : evaluate(B, ai);
+    if (side) { // max
+      if (stand >= beta) {
+        if (hash) qtt_store(g_qtt, hash, qdepth, beta, TT_LOWER, 0, stand, ply);
+        return beta;
+      }
+      if (stand > alpha)  alpha = stand;
+    } else { // min
+      if (stand <= alpha) {
+        if (hash) qtt_store(g_qtt, hash, qdepth, alpha, TT_UPPER, 0, stand, ply);
+        return alpha;
+      }
+      if (stand < beta)   beta = stand;
+    }
+  }
+
+  uint64_t check_sq[NUM_PIECES] = { 0 }; // squares each piece type gives direct check from
+  if (!in_check && qply == 0) {
+    uint64_t occ = B->whites | B->blacks;
+    int ek = __builtin_ctzll(side ? B->BLACK[KING] : B->WHITE[KING]);
+    uint64_t k = 1ULL << ek;
+    check_sq[PAWN] = side ? ((k & ~FILE_A) >> 9) | ((k & ~FILE_H) >> 7) : ((k & ~FILE_A) << 7) | ((k & ~FILE_H) << 9);
+    check_sq[KNIGHT] = B->jumps[ek];
+    check_sq[BISHOP] = generate_bishop_attacks(ek, occ);
+    check_sq[ROOK] = generate_rook_attacks(ek, occ);
+    check_sq[QUEEN] = check_sq[BISHOP] | check_sq[ROOK];
   }
 
-  move_t caps[MAX_MOVES];
+  move_t qmoves[MAX_MOVES];
   int n = 0;
   move_t* mv;
-  int mcount = movegen_ply(B, side, 0, qply, &mv, qmove_stack, MAX_MOVES); // pseudo legal
+  int mcount = movegen_ply(B, side, 0, qply, &mv, qmove_stack, MAX_MOVES, ai); // pseudo legal
 
-  // filter captures and score by SEE for ordering
+  // captures and queen promotions, evasions in check, direct checks on the first ply
   for (int i = 0; i < mcount; ++i) {
     uint64_t to_mask = 1ULL << mv[i].to;
     int is_cap = side ? ((B->blacks & to_mask) != 0) : ((B->whites & to_mask) != 0);
@@ -419,73 +608,115 @@ int quiesce(board* B, int side, int alpha, int beta, long* info, int qply) {
       int vic = victim_square(B, side, mv[i].to);
       int vic_val = (vic >= 0 ? see_value(vic) : 0);
       int atk_val = see_value(mv[i].piece);
-
-      mv[i].order = vic_val * 16 - atk_val;
-      caps[n++] = mv[i];
+      mv[i].order = vic_val * 16 - atk_val + *capture_history(B, side, &mv[i]) / CAPT_HIST_ORDER_DIV;
+    } else if (mv[i].promo == QUEEN) {
+      mv[i].order = (SEE_QUEEN - SEE_PAWN) * 16;
+    } else if (in_check || (check_sq[mv[i].piece] & to_mask)) {
+      mv[i].order = -(1 << 20) + hist->quiet[side][mv[i].piece][mv[i].to]; // after every capture
+    } else {
+      continue;
     }
+    if (qtt_move && tt_encode_move(mv[i].from, mv[i].to, mv[i].promo) == qtt_move)
+      mv[i].order = INT32_MAX; // previous best move first
+    qmoves[n++] = mv[i];
     if (n == MAX_MOVES) break;
   }
 
-  move_sort(caps, n);
+  move_sort(qmoves, n);
 
+  move_t best_move = { .from = NONE_PIECE }; // raised the bound, for the qtt
+  int legal = 0;
   for (int i = 0; i < n; ++i) {
-    int piecev = victim_square(B, side, caps[i].to);
+    int piecev = victim_square(B, side, qmoves[i].to);
     int valv = (piecev >= 0 ? see_value(piecev) : 0);
 
-    if (CAPPRUNE_ENABLED && piecev >= 0) { // skip captures that lose material
-      if (!see_ge(B, &caps[i], side, 0)) {
+    if (CAPPRUNE_ENABLED && !in_check && piecev >= 0) { // skip captures that lose material
+      if (!see_ge(B, &qmoves[i], side, 0)) {
         continue; // prune losing capture
       }
     }
 
+    if (!in_check && piecev < 0 && !qmoves[i].promo && !see_ge(B, &qmoves[i], side, 0)) {
+      continue; // quiet check that hangs the piece
+    }
+
     // best possible capture wont raise alpha
-    if (DELTA_PRUNE_ENABLED && DELTA_MARGIN > 0 && piecev >= 0 && abs(stand) < MATE - 2 * QUEEN_VALUE) {
+    if (DELTA_PRUNE_ENABLED && PARAM(DELTA_MARGIN) > 0 && !in_check && piecev >= 0 && abs(stand) < MATE - 2 * QUEEN_VALUE) {
       int max_gain = valv;
 
-      if (caps[i].piece == PAWN) {
-        uint64_t to_mask = 1ULL << caps[i].to;
+      if (qmoves[i].piece == PAWN) {
+        uint64_t to_mask = 1ULL << qmoves[i].to;
         if ((side && (to_mask & RANK_8)) || (!side && (to_mask & RANK_1))) {
           max_gain += SEE_QUEEN - SEE_PAWN; // promotion bonus
         }
       }
 
       if (side) {
-        if (stand + max_gain + DELTA_MARGIN <= alpha) {
+        if (stand + max_gain + PARAM(DELTA_MARGIN) <= alpha) {
           continue;
         }
       } else {
-        if (stand - max_gain - DELTA_MARGIN >= beta) {
+        if (stand - max_gain - PARAM(DELTA_MARGIN) >= beta) {
           continue;
         }
       }
     }
 
     undo_t u;
-    make_move(B, &caps[i], side, &u);
+    make_move(B, &qmoves[i], side, &u);
+    attack_info_t child;
+    compute_attacks(B, &child);
 
-    if (check(B, !side)) {  // illegal
-      unmake_move(B, &caps[i], side, &u);
+    if (child.checkers[side]) {  // illegal
+      unmake_move(B, &qmoves[i], side, &u);
       continue;
     }
-    int score = quiesce(B, !side, alpha, beta, info, qply + 1);
-    unmake_move(B, &caps[i], side, &u);
+    ++legal;
+    B->white = !side; // side to move for eval
+    int score = quiesce(B, &child, !side, alpha, beta, info, ply + 1, qply + 1);
+    B->white = side;
+    unmake_move(B, &qmoves[i], side, &u);
 
     if (side) {
-      if (score >= beta) return beta;
-      if (score > alpha) alpha = score;
+      if (score >= beta) {
+        if (hash) qtt_store(g_qtt, hash, qdepth, beta, TT_LOWER, tt_encode_move(qmoves[i].from, qmoves[i].to, qmoves[i].promo), stand, ply);
+        return beta;
+      }
+      if (score > alpha) {
+        alpha = score;
+        best_move = qmoves[i];
+      }
     } else {
-      if (score <= alpha) return alpha;
-      if (score < beta)   beta = score;
+      if (score <= alpha) {
+        if (hash) qtt_store(g_qtt, hash, qdepth, alpha, TT_UPPER, tt_encode_move(qmoves[i].from, qmoves[i].to, qmoves[i].promo), stand, ply);
+        return alpha;
+      }
+      if (score < beta) {
+        beta = score;
+        best_move = qmoves[i];
+      }
     }
   }
 
-  return side ? alpha : beta;
+  if (in_check && !legal) { // every move was generated, so this is mate
+    int score = side ? -MATE + ply : MATE - ply;
+    if (hash) qtt_store(g_qtt, hash, qdepth, score, TT_EXACT, 0, QTT_NO_EVAL, ply);
+    return score;
+  }
+
+  int result = side ? alpha : beta;
+  if (hash) {
+    tt_flag_t flag = (result <= orig_alpha) ? TT_UPPER : (result >= orig_beta) ? TT_LOWER : TT_EXACT;
+    uint16_t encoded = best_move.from != NONE_PIECE ? tt_encode_move(best_move.from, best_move.to, best_move.promo) : 0;
+    qtt_store(g_qtt, hash, qdepth, result, flag, encoded, stand, ply);
+  }
+  return result;
 }
 
-int oneply_check(board *B, int side, int alpha, int beta, long *info, int ply) { // assumes B->white == side and side is in check
-  if (ply >= MAX_PLY) return blended_eval(B);
+int oneply_check(board *B, const attack_info_t *ai, int side, int alpha, int beta, long *info, int ply) { // assumes B->white == side and side is in check
+  if (ply >= MAX_PLY) return evaluate(B, ai);
   move_t *moves;
-  int move_count = movegen_ply(B, side, 1, ply, &moves, move_stack, MAX_MOVES);  // legal moves only
+  int move_count = movegen_ply(B, side, 1, ply, &moves, move_stack, MAX_MOVES, ai);  // legal moves only
   int m = 0;
 
   if (move_count == 0) {
@@ -498,7 +729,9 @@ int oneply_check(board *B, int side, int alpha, int beta, long *info, int ply) {
   for (int i = 0; i < move_count; ++i) {
     undo_t u;
     make_move(B, &moves[i], side, &u);
-    int child = minimax(B, 0, !side, alpha, beta, info, ply + 1);
+    attack_info_t cai;
+    compute_attacks(B, &cai);
+    int child = minimax(B, &cai, 0, !side, alpha, beta, info, ply + 1, 0);
     unmake_move(B, &moves[i], side, &u);
 
     if (side) {
@@ -515,18 +748,110 @@ int oneply_check(board *B, int side, int alpha, int beta, long *info, int ply) {
   return best;
 }
 
+static int book_root(board *B, move_t *moves, int move_count) { // book move, or book moves ordered first and -1
+  uint64_t weights[MAX_MOVES];
+  int games = book_weights(B, moves, move_count, weights);
+  if (!games) return -1;
+  if (games >= BOOK_MIN_GAMES) {
+    int pick = book_choose(weights, move_count, &book_rng);
+    printf("Book: %c%c to %c%c (%d games)\n", 'a' + moves[pick].from % 8, '1' + moves[pick].from / 8,
+           'a' + moves[pick].to % 8, '1' + moves[pick].to / 8, games);
+    return moves[pick].from * 64 + moves[pick].to;
+  }
+  for (int i = 1; i < move_count; ++i) { // thin line, search it but try the book moves first
+    move_t m = moves[i];
+    uint64_t w = weights[i];
+    int j = i;
+    for (; j > 0 && weights[j - 1] < w; --j) {
+      moves[j] = moves[j - 1];
+      weights[j] = weights[j - 1];
+    }
+    moves[j] = m;
+    weights[j] = w;
+  }
+  return -1;
+}
+
+static int experience_root(board *B, move_t *moves, int move_count, int is_white, int depth, uint64_t key, int *score) { // known move and its score, or -1
+  exp_record_t rec;
+  if (exp_lookup(key, &rec)) {
+    for (int i = 0; i < move_count; ++i) {
+      if (tt_encode_move(moves[i].from, moves[i].to, moves[i].promo) != rec.move) continue;
+      if (rec.depth >= depth) { // already searched as deep as asked
+        printf("Experience: depth %d ", rec.depth);
+        print_move_eval("", moves[i].from * 64 + moves[i].to, rec.score);
+        *score = rec.score;
+        return moves[i].from * 64 + moves[i].to;
+      }
+      move_t m = moves[i]; // search it first
+      moves[i] = moves[0];
+      moves[0] = m;
+      break;
+    }
+  }
+
+  if (!TT_ENABLED || !g_tt) return -1;
+  for (int i = 0; i < move_count; ++i) { // seed children that were roots before
+    undo_t u;
+    make_move(B, &moves[i], is_white, &u);
+    B->white = !is_white;
+    if (exp_lookup(position_key(B), &rec))
+      tt_store(g_tt, hash_board(B), rec.depth, rec.score, TT_EXACT, rec.move, 0); // score already relative to the child
+    B->white = is_white;
+    unmake_move(B, &moves[i], is_white, &u);
+  }
+  return -1;
+}
+
+void search_ctx_init(search_ctx_t *ctx) {
+  ctx->tt = TT_ENABLED ? tt_create(tt_size_mb) : NULL;
+  ctx->qtt = TT_ENABLED ? qtt_create(QTT_SIZE_KB) : NULL;
+  ctx->hist = calloc(1, sizeof(search_hist_t));
+  if ((TT_ENABLED && (!ctx->tt || !ctx->qtt)) || !ctx->hist) {
+    fprintf(stderr, "Alloc failed\n");
+    exit(1);
+  }
+}
+
+void search_ctx_clear(search_ctx_t *ctx) {
+  tt_clear(ctx->tt);
+  qtt_clear(ctx->qtt);
+  memset(ctx->hist, 0, sizeof(search_hist_t));
+}
+
+void search_ctx_free(search_ctx_t *ctx) {
+  if (hist == ctx->hist) search_ctx_use(NULL);
+  tt_free(ctx->tt);
+  qtt_free(ctx->qtt);
+  free(ctx->hist);
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+void search_ctx_use(search_ctx_t *ctx) { // pointers only, switching engines every move costs nothing
+  g_tt = ctx ? ctx->tt : NULL;
+  g_qtt = ctx ? ctx->qtt : NULL;
+  hist = ctx ? ctx->hist : &thread_hist;
+}
+
 int find_move(bot *bot, int is_white, int limit) {
   long *info;
   double start = gtime();
   deadline = start + limit;
   time_flag = 0;
+  search_nodes = 0;
+  nodes = 0;
+  node_budget = bot->node_limit;
   init_ordering_tables();
+  nnue_reset(bot->B); // root reached outside make_move
   for (int i = 0; i < MAX_PLY; ++i) {
     pv_length[i] = 0;
   }
 
-  if (TT_ENABLED && !g_tt) {
-    g_tt = tt_create(TT_SIZE_MB);
+  if (TT_ENABLED && !g_tt) { // normally created at startup
+    g_tt = tt_create(tt_size_mb);
+  }
+  if (TT_ENABLED && !g_qtt) {
+    g_qtt = qtt_create(QTT_SIZE_KB);
   }
   if (TT_ENABLED && g_tt) {
     tt_new_search(g_tt);  // increase age
@@ -540,15 +865,31 @@ int find_move(bot *bot, int is_white, int limit) {
     fprintf(stderr, "Alloc failed\n");
     exit(1);
   }
+  memset(&stats, 0, sizeof(stats));
 #endif
   int move = -1;
   int best = is_white ? INT32_MIN : INT32_MAX;
   move_t *moves;
-  int move_count = movegen_ply(bot->B, is_white, 1, 0, &moves, move_stack, MAX_MOVES);
+  attack_info_t root_ai;
+  compute_attacks(bot->B, &root_ai);
+  int move_count = movegen_ply(bot->B, is_white, 1, 0, &moves, move_stack, MAX_MOVES, &root_ai);
   int depth;
   int comp_depth = 0;
   if (move_count == 0) return -1; // no legal moves
+  bot->score = 0;
+  sstack[0].static_eval = root_ai.checkers[is_white] ? NO_EVAL : evaluate(bot->B, &root_ai);
+  if (BOOK_ENABLED && bot->use_book && book_ready()) { // reached by transposition too
+    int known = book_root(bot->B, moves, move_count);
+    if (known != -1) return known; // the book has no eval, the score stays 0
+  }
+  uint64_t root_key = EXPERIENCE_ENABLED && bot->use_book && exp_ready() ? position_key(bot->B) : 0;
+  if (root_key) {
+    int known = experience_root(bot->B, moves, move_count, is_white, bot->depth, root_key, &bot->score);
+    if (known != -1) return known;
+  }
   for (depth = 1; depth <= bot->depth; ++depth) {
+    root_depth = depth;
+    search_nodes += nodes;
     nodes = 0;
     int i;
     int lbest = is_white ? INT32_MIN : INT32_MAX;
@@ -558,7 +899,18 @@ int find_move(bot *bot, int is_white, int limit) {
       make_move(bot->B, &moves[i], is_white, &u);
       last_move[0] = moves[i]; // last move
       bot->B->white = !is_white;
-      int eval = minimax(bot->B, depth - 1, !is_white, INT32_MIN, INT32_MAX, info, 1);
+      attack_info_t child;
+      compute_attacks(bot->B, &child);
+      int eval;
+      if (!PVS_ENABLED || i == 0) {
+        eval = minimax(bot->B, &child, depth - 1, !is_white, INT32_MIN, INT32_MAX, info, 1, 0);
+      } else { // null window on the best so far, full window only for a new best
+        eval = is_white ? minimax(bot->B, &child, depth - 1, 0, lbest, lbest + 1, info, 1, 1)
+                        : minimax(bot->B, &child, depth - 1, 1, lbest - 1, lbest, info, 1, 1);
+        if (is_white ? eval > lbest : eval < lbest)
+          eval = is_white ? minimax(bot->B, &child, depth - 1, 0, lbest, INT32_MAX, info, 1, 0)
+                          : minimax(bot->B, &child, depth - 1, 1, INT32_MIN, lbest, info, 1, 0);
+      }
       bot->B->white = is_white;
       unmake_move(bot->B, &moves[i], is_white, &u);
       int packed = moves[i].from * 64 + moves[i].to;
@@ -590,22 +942,47 @@ int find_move(bot *bot, int is_white, int limit) {
     }
     best = lbest;
     move = lmove;
+    comp_depth = depth;
     best_pv_len = pv_length[0]; // save pv line
     for (int k = 0; k < best_pv_len; ++k)
       best_pv[k] = pv_table[0][k];
+    for (int k = 1; k < move_count; ++k) { // next iteration searches this move first
+      if (moves[k].from * 64 + moves[k].to != move) continue;
+      move_t m = moves[k];
+      memmove(&moves[1], &moves[0], k * sizeof(move_t));
+      moves[0] = m;
+      break;
+    }
 #ifdef DEBUG
     printf("Depth %d ran in %lf seconds, best move: %d, eval: %d\n", depth, gtime() - start, move, best);
 #endif
-    printf("Depth %d best: ", depth);
-    print_move_eval("", move, best);
+    if (!bot->quiet) {
+      printf("Depth %d best: ", depth);
+      print_move_eval("", move, best);
+    }
   }
 end_find:
+  bot->score = best;
+  if (TT_ENABLED && g_tt && !bot->quiet) printf("Hashfull: %d/1000\n", tt_hashfull(g_tt));
+  if (root_key && comp_depth >= EXP_MIN_DEPTH && best_pv_len > 0) // pv[0] is the completed iteration's move
+    exp_append(root_key, tt_encode_move(best_pv[0].from, best_pv[0].to, best_pv[0].promo), best, comp_depth, is_white);
 #ifdef DEBUG
   clock_t debug_end = clock();
   double time = (double)(debug_end - debug_start) / CLOCKS_PER_SEC;
   printf("Time taken: %f seconds\n", time);
   printf("Visited nodes: %ld, leaf nodes: %ld, quiescence nodes %ld\n", *info, *(info + 1), *(info + 2));
-  printf("Eval: %d, Mid Eval: %d, End Eval %d, Phase: %d, Scale: %d\n", best, mid_eval(bot->B), end_eval(bot->B), phase(bot->B), scale(bot->B, end_eval(bot->B)));
+  printf("LMR re-searches by reduction:");
+  for (int r = 0; r < LMR_STAT_BUCKETS; ++r)
+    printf(" R%d%s %ld/%ld", r + 1, r == LMR_STAT_BUCKETS - 1 ? "+" : "", stats.lmr_research[r], stats.lmr_tried[r]);
+  printf("\n");
+  printf("Singular searches: %ld, extended: %ld, multi-cut: %ld\n", stats.se_tried, stats.se_extended, stats.se_multi_cut);
+  printf("ProbCut: %ld captures searched, %ld nodes cut\n", stats.probcut_tried, stats.probcut_cut);
+  printf("Nodes without a TT move: PV %ld/%ld, cut %ld/%ld, all %ld/%ld\n", stats.tt_missing[0], stats.tt_nodes[0],
+         stats.tt_missing[1], stats.tt_nodes[1], stats.tt_missing[2], stats.tt_nodes[2]);
+  printf("Eval: %d, Mid Eval: %d, End Eval %d, Phase: %d, Scale: %d\n", best, mid_eval(bot->B, &root_ai), end_eval(bot->B), phase(bot->B), scale(bot->B, end_eval(bot->B)));
+#ifdef EVAL_TRACE
+  eval_trace_print(bot->B);
+#endif
   printf("Main PV line: ");
     for (int i = 0; i < pv_length[0]; ++i) {
       int from = pv_table[0][i].from;
@@ -667,18 +1044,12 @@ static void score_moves(const board *B, move_t *mv, int n, int side_to_move, int
     if (tt_move != 0 && mv[i].from == tt_from && mv[i].to == tt_to) { // prioritize TT move
       score = (1 << 24);  // highest
     } else if (is_capture(B, side_to_move, &mv[i])) {
-      // SEE, winning/equal captures high, losing captures low
-      int see_score = see(B, &mv[i], side_to_move);
-
-      if (see_score >= 0) {
-        int vic = victim_square(B, side_to_move, mv[i].to);
-        int mvvlva_bonus = (vic >= 0 ? mvv_lva[vic][mv[i].piece] : 0); // mvvlva tie breaker
-        score = (1 << 23) + see_score + mvvlva_bonus;
-      } else {
-        int vic = victim_square(B, side_to_move, mv[i].to);
-        int mvvlva_bonus = (vic >= 0 ? mvv_lva[vic][mv[i].piece] : 0);
-        score = (1 << 17) + mvvlva_bonus + see_score; // see_score negative
-      }
+      // SEE sign only, winning/equal captures high, losing captures low, mvvlva then capture history within
+      int vic = victim_square(B, side_to_move, mv[i].to);
+      int mvvlva_bonus = (vic >= 0 ? mvv_lva[vic][mv[i].piece] : 0);
+      int ch = hist->capt[side_to_move][mv[i].piece][mv[i].to][vic >= 0 ? vic : PAWN] / CAPT_HIST_ORDER_DIV;
+      if (see_ge(B, &mv[i], side_to_move, 0)) score = (1 << 23) + mvvlva_bonus * 1024 + ch;
+      else score = (1 << 17) + mvvlva_bonus * 1024 + ch;
     } else {
       // killers
       if (equals(killer1[ply], mv[i])) score = (1 << 21);
@@ -688,8 +1059,8 @@ static void score_moves(const board *B, move_t *mv, int n, int side_to_move, int
         score += (1 << 19); // under killer1
       }
 
-      // history
-      score += history_tbl[side_to_move][mv[i].piece][mv[i].to];
+      // butterfly and continuation history
+      score += quiet_history(side_to_move, ply, &mv[i]);
     }
     mv[i].order = score;
   }
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "lib/board.h"
+#include "lib/bot.h"
+#include "lib/eval.h"
+#include "lib/magic.h"
+#include "lib/manager.h"
+#include "lib/opening.h"
+#include "lib/tt.h"
+#include "lib/datagen.h"
+
+static struct {
+  int depth;
+  long nodes;
+  int book_plies, random_plies;
+  uint64_t target; // positions to write
+} dg;
+
+static struct {
+  FILE *out;
+  uint64_t written, generated, games; // generated counts positions still in thread buffers
+  double start, last_report;
+  pthread_mutex_t lock;
+} writer = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void pack_position(const board *B, int score, int result, int ply, packed_pos_t *out) {
+  memset(out, 0, sizeof(*out));
+  out->occupancy = B->whites | B->blacks;
+  int n = 0;
+  for (uint64_t occ = out->occupancy; occ && n < 32; occ &= occ - 1, ++n) {
+    int sq = __builtin_ctzll(occ);
+    int pt = piece_at(B, sq);
+    int code = PCODE(pt, (B->whites >> sq & 1) ? CONST_WHITE : CONST_BLACK);
+    out->pieces[n >> 1] |= code << ((n & 1) * 4);
+  }
+  out->score = (int16_t)score;
+  out->result = (int8_t)result;
+  out->flags = (B->white ? 1 : 0) | (B->castle & 0xF) << 4;
+  out->ply = (uint16_t)ply;
+}
+
+int unpack_position(const packed_pos_t *p, board *B) {
+  uint64_t W[NUM_PIECES] = { 0 }, Bl[NUM_PIECES] = { 0 };
+  if (__builtin_popcountll(p->occupancy) > 32) return 0;
+  int n = 0;
+  for (uint64_t occ = p->occupancy; occ; occ &= occ - 1, ++n) {
+    int sq = __builtin_ctzll(occ);
+    int code = p->pieces[n >> 1] >> ((n & 1) * 4) & 0xF;
+    if (code >= 2 * NUM_PIECES) return 0;
+    if ((code & 1) == CONST_WHITE) W[code >> 1] |= 1ULL << sq;
+    else Bl[code >> 1] |= 1ULL << sq;
+  }
+  if (__builtin_popcountll(W[KING]) != 1 || __builtin_popcountll(Bl[KING]) != 1) return 0;
+  load_position(B, W, Bl, p->flags & 1, p->flags >> 4, 0);
+  return 1;
+}
+
+static uint64_t dg_rand(uint64_t *s) { // xorshift64*, one state per thread
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 0x2545f4914f6cdd1dULL;
+}
+
+static int dg_opening(board *B, uint64_t *seed, int *ply) { // book walk then random moves, 0 if the game is already over
+  for (int i = 0; i < dg.book_plies + dg.random_plies; ++i) {
+    move_t *moves;
+    int count = movegen(B, B->white, &moves, 1);
+    int pick = -1;
+    if (!count) {
+      free(moves);
+      return 0;
+    }
+    if (i < dg.book_plies && book_ready()) {
+      uint64_t weights[MAX_MOVES];
+      book_weights(B, moves, count, weights);
+      pick = book_choose(weights, count, seed); // the worker's own state, rand() is shared
+    }
+    if (pick < 0 && i >= dg.book_plies) pick = (int)(dg_rand(seed) % count);
+    if (pick >= 0) {
+      undo_t u;
+      make_move(B, &moves[pick], B->white, &u);
+      B->white = !B->white;
+      ++*ply;
+    }
+    free(moves);
+  }
+  return 1;
+}
+
+static void dg_flush(packed_pos_t *buf, int n) { // streaming writer, the only shared state
+  pthread_mutex_lock(&writer.lock);
+  uint64_t room = writer.written < dg.target ? dg.target - writer.written : 0;
+  if ((uint64_t)n > room) n = (int)room;
+  if (n && fwrite(buf, sizeof(packed_pos_t), n, writer.out) != (size_t)n) {
+    perror("datagen write");
+    exit(1);
+  }
+  writer.written += n;
+  double now = gtime();
+  if (now - writer.last_report >= 10 || writer.written >= dg.target) {
+    writer.last_report = now;
+    printf("Positions %llu, games %llu, %.0f pos/s\n", (unsigned long long)writer.written,
+           (unsigned long long)writer.games, writer.written / (now - writer.start));
+    fflush(stdout);
+  }
+  pthread_mutex_unlock(&writer.lock);
+}
+
+static int dg_done(void) {
+  pthread_mutex_lock(&writer.lock);
+  int done = writer.generated >= dg.target;
+  pthread_mutex_unlock(&writer.lock);
+  return done;
+}
+
+static void *dg_worker(void *arg) {
+  uint64_t seed = (uint64_t)(uintptr_t)arg * 0x9e3779b97f4a7c15ULL ^ (uint64_t)time(NULL);
+  if (!seed) seed = 1;
+  packed_pos_t *buf = malloc(DATAGEN_BUFFER * sizeof(packed_pos_t));
+  packed_pos_t game[DATAGEN_MAX_PLIES];
+  uint64_t keys[DATAGEN_MAX_PLIES + 1];
+  int buffered = 0;
+  if (!buf) {
+    perror("datagen malloc");
+    exit(1);
+  }
+  board *B = init_board();
+  bot *player = init_bot(B, 1, dg.depth, 3600); // depth and nodes bound it
+  player->node_limit = dg.nodes;
+  player->quiet = 1;
+  player->use_book = 0;
+
+  while (!dg_done()) {
+    board *start = init_board();
+    load_position(B, start->WHITE, start->BLACK, 1, start->castle, 0);
+    free_board(start);
+    int ply = 0;
+    if (!dg_opening(B, &seed, &ply)) continue;
+    if (TT_ENABLED && g_tt) tt_clear(g_tt);
+
+    int n = 0, quiet_plies = 0, win_plies = 0, result = 2, hist = 0;
+    keys[hist++] = position_key(B);
+    while (result == 2) {
+      int side = B->white;
+      move_t *moves;
+      int count = movegen(B, side, &moves, 1);
+      if (!count) {
+        result = check(B, !side) ? (side ? -1 : 1) : 0;
+        free(moves);
+        break;
+      }
+      player->white = side;
+      int code = find_move(player, side, player->limit);
+      move_t m = { .from = 255 };
+      for (int i = 0; i < count; ++i)
+        if (moves[i].from * 64 + moves[i].to == code && (m.from == 255 || moves[i].promo == QUEEN)) m = moves[i];
+      free(moves);
+      if (m.from == 255) break; // no result, drop the game
+
+      int score = player->score;
+      int capture = ((side ? B->blacks : B->whites) >> m.to & 1) != 0;
+      int in_check = check(B, !side);
+      if (!in_check && !capture && !m.promo && abs(score) < DATAGEN_MAX_SCORE && n < DATAGEN_MAX_PLIES)
+        pack_position(B, score, 0, ply, &game[n++]); // quiet, result filled in below
+
+      win_plies = abs(score) >= DATAGEN_WIN_SCORE ? win_plies + 1 : 0;
+      undo_t u;
+      make_move(B, &m, side, &u);
+      B->white = !side;
+      ++ply;
+      quiet_plies = (m.piece == PAWN || u.captured_piece >= 0) ? 0 : quiet_plies + 1;
+      keys[hist++] = position_key(B);
+
+      int reps = 0;
+      for (int i = hist - 3; i >= 0 && i >= hist - 1 - quiet_plies; i -= 2)
+        reps += keys[i] == keys[hist - 1];
+      if (reps >= 2 || quiet_plies >= 100 || insufficient_material(B) || hist > DATAGEN_MAX_PLIES)
+        result = 0;
+      else if (win_plies >= DATAGEN_WIN_PLIES)
+        result = score > 0 ? 1 : -1;
+    }
+    if (result == 2) continue;
+
+    for (int i = 0; i < n; ++i) {
+      game[i].result = (int8_t)result;
+      buf[buffered++] = game[i];
+      if (buffered == DATAGEN_BUFFER) {
+        dg_flush(buf, buffered);
+        buffered = 0;
+      }
+    }
+    pthread_mutex_lock(&writer.lock);
+    writer.generated += n;
+    ++writer.games;
+    pthread_mutex_unlock(&writer.lock);
+  }
+  if (buffered) dg_flush(buf, buffered);
+
+  free(buf);
+  free(player);
+  free_board(B);
+  if (g_tt) tt_free(g_tt);
+  if (g_qtt) qtt_free(g_qtt);
+  g_tt = NULL;
+  g_qtt = NULL;
+  return NULL;
+}
+
+int datagen_main(int argc, char **argv) {
+  if (argc < 1) {
+    fprintf(stderr, "Usage: ./a.out datagen <out> [--positions n] [--depth d] [--nodes n] [--concurrency n] [--book-plies n] [--random-plies n] [--hash mb]\n");
+    return 1;
+  }
+  init_attack_tables();
+  init_pesto_tables();
+  srand(time(NULL));
+  dg.depth = 5;
+  dg.nodes = 0;
+  dg.book_plies = DATAGEN_BOOK_PLIES;
+  dg.random_plies = DATAGEN_RANDOM_PLIES;
+  dg.target = 1000000;
+  int threads = 0;
+  tt_size_mb = DATAGEN_HASH_MB;
+
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Missing value for %s\n", argv[i]);
+      return 1;
+    }
+    if (!strcmp(argv[i], "--positions")) dg.target = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--depth")) dg.depth = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--nodes")) dg.nodes = atol(argv[++i]);
+    else if (!strcmp(argv[i], "--concurrency")) threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--book-plies")) dg.book_plies = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--random-plies")) dg.random_plies = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--hash")) tt_size_mb = (size_t)atol(argv[++i]);
+    else {
+      fprintf(stderr, "Unknown datagen option: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1) threads = 1;
+  if (threads > DATAGEN_MAX_THREADS) threads = DATAGEN_MAX_THREADS;
+  if (dg.depth < 1 || !tt_size_mb) {
+    fprintf(stderr, "Bad datagen options.\n");
+    return 1;
+  }
+
+  writer.out = fopen(argv[0], "ab");
+  if (!writer.out) {
+    perror("failed to open datagen output");
+    return 1;
+  }
+  setvbuf(writer.out, NULL, _IOFBF, 1 << 20);
+  if (!book_open(BOOK_FILE))
+    fprintf(stderr, "WARNING: no %s, openings are random moves only.\n", BOOK_FILE);
+  writer.start = writer.last_report = gtime();
+  printf("Datagen: %llu positions to %s on %d threads, depth %d nodes %ld\n",
+         (unsigned long long)dg.target, argv[0], threads, dg.depth, dg.nodes);
+
+  pthread_t tids[DATAGEN_MAX_THREADS];
+  for (int t = 0; t < threads; ++t)
+    pthread_create(&tids[t], NULL, dg_worker, (void *)(uintptr_t)(t + 1));
+  for (int t = 0; t < threads; ++t)
+    pthread_join(tids[t], NULL);
+
+  int ok = fclose(writer.out) == 0;
+  book_close();
+  return ok ? 0 : 1;
+}
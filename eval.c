@@ -1,22 +1,23 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "lib/board.h"
 #include "lib/eval.h"
 #include "lib/utils.h"
+#include "lib/magic.h"
+#include "lib/nnue.h"
 
 const int PIECE_VALUES[NUM_PIECES] = {100, 320, 330, 500, 900, 20000};
 const int END_VALUES[NUM_PIECES] = {120, 310, 340, 500, 900, 20000};
 const int TOTAL_PHASE = ((KNIGHT_PHASE * 4) + (BISHOP_PHASE * 4) + (ROOK_PHASE * 4) + (QUEEN_PHASE * 2));
 
-uint64_t wmoves;
-uint64_t bmoves;
-
 int tapered(const board *B) {
-  wmoves = white_moves(B);
-  bmoves = black_moves(B);
+  attack_info_t ai;
+  compute_attacks(B, &ai);
 
-  int mg = mid_eval(B);
+  int mg = mid_eval(B, &ai);
   int eg = end_eval(B);
   int p = phase(B);
   eg = eg * scale(B, eg) / 64;
@@ -38,25 +39,29 @@ int center_control(const board *B) {
   const uint64_t CENTER = (FILE_D | FILE_E) & (RANK_4 | RANK_5);
   uint64_t wcont = B->whites & CENTER;
   uint64_t bcont = B->blacks & CENTER;
+  TRACE(etrace.coeff[T_CENTER][1] = 2 * __builtin_popcountll(wcont), etrace.coeff[T_CENTER][0] = 2 * __builtin_popcountll(bcont));
   return 2 * (__builtin_popcountll(wcont) - __builtin_popcountll(bcont));
 }
 
-int king_safe(const board *B) {
-  uint64_t wking = wk_moves(B->WHITE[KING], B->whites);
-  uint64_t bking = bk_moves(B->BLACK[KING], B->blacks);
-  int wsafe = __builtin_popcountll(wking & bmoves);
-  int bsafe = __builtin_popcountll(bking & wmoves);
+int king_safe(const board *B, const attack_info_t *ai) {
+  uint64_t wking = ai->king_zone[1] & ~B->whites;
+  uint64_t bking = ai->king_zone[0] & ~B->blacks;
+  int wsafe = __builtin_popcountll(wking & ai->moves[0]);
+  int bsafe = __builtin_popcountll(bking & ai->moves[1]);
+  TRACE(etrace.coeff[T_KING_SAFETY][1] = -wsafe, etrace.coeff[T_KING_SAFETY][0] = -bsafe);
   return (bsafe - wsafe);
 }
 
-int mobility(const board *B) {
-  int wmobile = __builtin_popcountll(wmoves);
-  int bmobile = __builtin_popcountll(bmoves);
-  return (wmobile - bmobile) / 2;
+int mobility(const board *B, const attack_info_t *ai) {
+  int wmobile = __builtin_popcountll(ai->moves[1]);
+  int bmobile = __builtin_popcountll(ai->moves[0]);
+  int diff = (wmobile - bmobile) / 2; // halved after the difference, so each side's half is rounded off that
+  TRACE(etrace.coeff[T_MOBILITY][1] = bmobile / 2 + diff, etrace.coeff[T_MOBILITY][0] = bmobile / 2);
+  return diff;
 }
 
-int mid_eval(const board *B) {
-  return mat_eval(B) + center_control(B) + king_safe(B) + mobility(B);
+int mid_eval(const board *B, const attack_info_t *ai) {
+  return mat_eval(B) + center_control(B) + king_safe(B, ai) + mobility(B, ai);
 }
 
 int phase(const board *B) {
@@ -101,6 +106,7 @@ int king_activity(const board *B) {
   int bking = (B->BLACK[KING] & mid_ranks) != 0;
   int w = wking ? (ACTIVE_KING) : 0;
   int b = bking ? (ACTIVE_KING) : 0;
+  TRACE(etrace.coeff[T_KING_ACTIVITY][1] = w, etrace.coeff[T_KING_ACTIVITY][0] = b);
   return (w - b);
 }
 
@@ -109,6 +115,7 @@ int pawn_structure(const board *B) {
   const uint64_t BPROMOTE = RANK_2;
   uint64_t wp = B->WHITE[PAWN] & WPROMOTE;
   uint64_t bp = B->BLACK[PAWN] & BPROMOTE;
+  TRACE(etrace.coeff[T_PSTRUCT][1] = __builtin_popcountll(wp) * PAWN_PROMOTE, etrace.coeff[T_PSTRUCT][0] = __builtin_popcountll(bp) * PAWN_PROMOTE);
   return ((__builtin_popcountll(wp) - __builtin_popcountll(bp)) * (PAWN_PROMOTE));
 }
 
@@ -117,6 +124,7 @@ int passed_pawns(const board *B) {
   uint64_t bp = B->BLACK[PAWN];
   uint64_t wpass = sided_passed_pawns(wp, bp, 1);
   uint64_t bpass = sided_passed_pawns(bp, wp, 0);
+  TRACE(etrace.coeff[T_PASSED][1] = PAWN_PASSED * __builtin_popcountll(wpass), etrace.coeff[T_PASSED][0] = PAWN_PASSED * __builtin_popcountll(bpass));
   return (PAWN_PASSED * (__builtin_popcountll(wpass) - __builtin_popcountll(bpass)));
 }
 
@@ -126,17 +134,19 @@ int development(const board *B) {
   int w_undeveloped = __builtin_popcountll(wminors & RANK_1);
   uint64_t bminors = B->BLACK[KNIGHT] | B->BLACK[BISHOP]; // black minor pieces
   int b_undeveloped = __builtin_popcountll(bminors & RANK_8);
+  TRACE(etrace.coeff[T_DEV][1] = -DEV_PENALTY * w_undeveloped, etrace.coeff[T_DEV][0] = -DEV_PENALTY * b_undeveloped);
   score -= DEV_PENALTY * w_undeveloped;
   score += DEV_PENALTY * b_undeveloped;
   return score;
 }
 
-int castle_eval(const board *B) {
+int castle_eval(const board *B) { // castled sides, weighted by CASTLE_W
   int score = 0;
   if (B->cc & (WKS | WQS)) // white castled
-    score += CASTLE_PT;
+    score += 1;
   if (B->cc & (BKS | BQS)) // black castled
-    score -= CASTLE_PT;
+    score -= 1;
+  TRACE(etrace.coeff[T_CASTLE][1] = (B->cc & (WKS | WQS)) != 0, etrace.coeff[T_CASTLE][0] = (B->cc & (BKS | BQS)) != 0);
   return score;
 }
 
@@ -151,24 +161,19 @@ static inline int pop_lsb(uint64_t *bb) {
 }
 
 void init_pesto_tables(void) {
-  for (int pt = PAWN; pt <= KING; ++pt) {
-    int wpc = PCODE(pt, CONST_WHITE);
-    int bpc = PCODE(pt, CONST_BLACK);
-    for (int sq = 0; sq < 64; ++sq) {
-      mg_table[wpc][sq] = mg_value[pt] + (pt == PAWN ? mg_pawn_table[sq] : pt == KNIGHT?mg_knight_table[sq] : pt == BISHOP ? mg_bishop_table[sq] : pt == ROOK ? mg_rook_table[sq] : pt == QUEEN ? mg_queen_table[sq] : mg_king_table[sq]);
-      eg_table[wpc][sq] = eg_value[pt] + (pt==PAWN ? eg_pawn_table[sq] : pt==KNIGHT ? eg_knight_table[sq] : pt==BISHOP ? eg_bishop_table[sq] : pt==ROOK ? eg_rook_table[sq] : pt==QUEEN ? eg_queen_table[sq] : eg_king_table[sq]);
-
-      // flip for black
-      int fsq = FLIP(sq);
-      mg_table[bpc][sq] = mg_value[pt] + (pt==PAWN ? mg_pawn_table[fsq] : pt==KNIGHT ? mg_knight_table[fsq] : pt==BISHOP ? mg_bishop_table[fsq] : pt==ROOK ? mg_rook_table[fsq] : pt==QUEEN ? mg_queen_table[fsq] : mg_king_table[fsq]);
-      eg_table[bpc][sq] = eg_value[pt] + (pt==PAWN ? eg_pawn_table[fsq] : pt==KNIGHT ? eg_knight_table[fsq] : pt==BISHOP ? eg_bishop_table[fsq] : pt==ROOK ? eg_rook_table[fsq] : pt==QUEEN ? eg_queen_table[fsq] : eg_king_table[fsq]);
-    }
-  }
+#ifdef TUNE
+  static int ready = 0; // keep values loaded from main
+  if (!ready) params_init(&default_params);
+  ready = 1;
+#else
+  params_t p;
+  params_init(&p);
+  memcpy(psqt, p.psqt, sizeof(psqt));
+#endif
 }
 
-void pesto_terms(const board *B, int *mg, int *eg, int *p24) {
-  int mgW = 0, mgB = 0;
-  int egW = 0, egB = 0;
+score_t pesto_terms(const board *B, int *p24) {
+  score_t s = 0;
   int gp = 0;
 
   for (int pt = PAWN; pt <= KING; ++pt) {
@@ -177,61 +182,178 @@ void pesto_terms(const board *B, int *mg, int *eg, int *p24) {
     int wpc = PCODE(pt, CONST_WHITE);
     while (bb) {
       int sq = pop_lsb(&bb);
-      mgW += mg_table[wpc][sq];
-      egW += eg_table[wpc][sq];
-      gp  += gpi[wpc];
+      s += PSQT(wpc, sq);
+      TRACE(etrace.psqt[1] += PSQT(wpc, sq));
+      gp += gpi[wpc];
     }
     // black
     bb = B->BLACK[pt];
     int bpc = PCODE(pt, CONST_BLACK);
     while (bb) {
       int sq = pop_lsb(&bb);
-      mgB += mg_table[bpc][sq];
-      egB += eg_table[bpc][sq];
-      gp  += gpi[bpc];
+      s -= PSQT(bpc, sq);
+      TRACE(etrace.psqt[0] += PSQT(bpc, sq));
+      gp += gpi[bpc];
     }
   }
 
   if (gp > 24) gp = 24;
-  *mg = (mgW - mgB);
-  *eg = (egW - egB);
   *p24 = gp;
+  return s;
 }
 
-int blended_eval(const board *B) {
-  wmoves = white_moves(B);
-  bmoves = black_moves(B);
+int blended_eval(const board *B, const attack_info_t *ai) {
+  TRACE(memset(&etrace, 0, sizeof(etrace)));
 
   // PeSTO
-  int mg_psqt, eg_psqt, phase24;
-  pesto_terms(B, &mg_psqt, &eg_psqt, &phase24);
+  int phase24;
+  score_t total = pesto_terms(B, &phase24);
   int mgPhase = phase24;
   int egPhase = 24 - mgPhase;
 
-  // heuristics
-  int mob = mobility(B);
-  int ctr = center_control(B);
-  int ks = king_safe(B);
-  int ka = king_activity(B);
-  int pstr = pawn_structure(B);
-  int pps = passed_pawns(B);
-  int castle = castle_eval(B);
-  int dev = development(B);
+  // heuristics, one packed add per term
+  total += PARAM(MOBILITY_W) * mobility(B, ai);
+  total += PARAM(CENTER_W) * center_control(B);
+  total += PARAM(KING_SAFETY_W) * king_safe(B, ai);
+  total += PARAM(KING_ACTIVITY_W) * king_activity(B);
+  total += PARAM(PSTRUCT_W) * pawn_structure(B);
+  total += PARAM(PASSED_W) * passed_pawns(B);
+  total += PARAM(DEV_W) * development(B);
+  total += PARAM(CASTLE_W) * castle_eval(B);
 
-  // feature sums
-  int mg_feats = (MOBILITY_MG * mob) + (CENTER_MG * ctr) + (KING_SAFETY_MG * ks) + castle + (DEV_MG * dev);
-  int eg_feats = (MOBILITY_EG * mob) + (CENTER_EG * ctr) + (KING_ACTIVITY_EG * ka) + (PSTRUCT_EG * pstr) + (PASSED_EG * pps);
-
-  int mg_total = mg_psqt + mg_feats;
-  int eg_total = eg_psqt + eg_feats;
+  int mg_total = mg_score(total);
+  int eg_total = eg_score(total);
 
   // scale
   int eg_scaled = (eg_total * scale(B, eg_total)) / 64;
   int score = (mg_total * mgPhase + eg_scaled * egPhase) / 24;
 
   // tempo
-  if (B->white) score += TEMPO_BONUS;
-  else score -= TEMPO_BONUS;
+  if (B->white) score += PARAM(TEMPO_BONUS);
+  else score -= PARAM(TEMPO_BONUS);
 
+  TRACE(etrace.phase24 = phase24, etrace.scale = scale(B, eg_total), etrace.tempo = B->white ? PARAM(TEMPO_BONUS) : -PARAM(TEMPO_BONUS), etrace.eval = score);
   return score;
-}
\ No newline at end of file
+}
+
+int evaluate(const board *B, const attack_info_t *ai) { // NNUE when attached, blended_eval otherwise
+  if (B->nnue) return nnue_evaluate(B);
+  return blended_eval(B, ai);
+}
+
+#ifdef EVAL_TRACE
+_Thread_local eval_trace_t etrace; // per search thread, like the search state in bot.h
+
+static const char *term_names[NUM_TERMS] = { "PSQT", "Mobility", "Center", "King safety", "King activity", "Pawn structure", "Passed pawns", "Castling", "Development" };
+void eval_trace_print(const board *B) {
+  const score_t term_weights[NUM_TERMS] = { 0, PARAM(MOBILITY_W), PARAM(CENTER_W), PARAM(KING_SAFETY_W), PARAM(KING_ACTIVITY_W), PARAM(PSTRUCT_W), PARAM(PASSED_W), PARAM(CASTLE_W), PARAM(DEV_W) };
+  attack_info_t ai;
+  compute_attacks(B, &ai);
+  blended_eval(B, &ai);
+
+  score_t sum = 0;
+  printf("%-16s|     White     |     Black     |     Total\n", "Term");
+  printf("%-16s|    MG     EG  |    MG     EG  |    MG     EG\n", "");
+  printf("----------------+---------------+---------------+--------------\n");
+  for (int t = 0; t < NUM_TERMS; ++t) {
+    score_t w = (t == T_PSQT) ? etrace.psqt[1] : term_weights[t] * etrace.coeff[t][1];
+    score_t b = (t == T_PSQT) ? etrace.psqt[0] : term_weights[t] * etrace.coeff[t][0];
+    sum += w - b;
+    printf("%-16s| %6d %6d | %6d %6d | %6d %6d\n", term_names[t], mg_score(w), eg_score(w), mg_score(b), eg_score(b), mg_score(w - b), eg_score(w - b));
+  }
+  printf("----------------+---------------+---------------+--------------\n");
+  printf("%-16s|               |               | %6d %6d\n", "Total", mg_score(sum), eg_score(sum));
+  printf("Phase: %d/24, Scale: %d/64, Tempo: %d\n", etrace.phase24, etrace.scale, etrace.tempo);
+  printf("Eval: %d (white)\n", etrace.eval);
+}
+
+void eval_trace_fen(const char *fen) {
+  init_attack_tables();
+  init_pesto_tables();
+  board *B = init_board();
+  if (!load_fen(B, fen)) {
+    fprintf(stderr, "Failed to load FEN position: %s\n", fen);
+    exit(1);
+  }
+  eval_trace_print(B);
+  free_board(B);
+}
+#endif
+
+#ifdef EVAL_BENCH
+// uniform wrappers so each term can be timed through one loop
+static int b_attacks(const board *B, const attack_info_t *ai) { (void)ai; attack_info_t a; compute_attacks(B, &a); return (int)a.all[1]; }
+static int b_psqt(const board *B, const attack_info_t *ai) { (void)ai; int p; return pesto_terms(B, &p); }
+static int b_mobility(const board *B, const attack_info_t *ai) { return mobility(B, ai); }
+static int b_center(const board *B, const attack_info_t *ai) { (void)ai; return center_control(B); }
+static int b_king_safe(const board *B, const attack_info_t *ai) { return king_safe(B, ai); }
+static int b_king_activity(const board *B, const attack_info_t *ai) { (void)ai; return king_activity(B); }
+static int b_pstruct(const board *B, const attack_info_t *ai) { (void)ai; return pawn_structure(B); }
+static int b_passed(const board *B, const attack_info_t *ai) { (void)ai; return passed_pawns(B); }
+static int b_castle(const board *B, const attack_info_t *ai) { (void)ai; return castle_eval(B); }
+static int b_dev(const board *B, const attack_info_t *ai) { (void)ai; return development(B); }
+static int b_scale(const board *B, const attack_info_t *ai) { (void)ai; return scale(B, 0); }
+static int b_phase(const board *B, const attack_info_t *ai) { (void)ai; return phase(B); }
+static int b_blended(const board *B, const attack_info_t *ai) { return blended_eval(B, ai); }
+
+#define BENCH_MAX_POS (4096)
+#define BENCH_EVALS (2000000) // evaluations per term
+
+void eval_bench(const char *path) {
+  static const struct { const char *name; int (*fn)(const board *, const attack_info_t *); } terms[] = {
+    { "compute_attacks", b_attacks }, { "PSQT", b_psqt }, { "Mobility", b_mobility }, { "Center", b_center },
+    { "King safety", b_king_safe }, { "King activity", b_king_activity }, { "Pawn structure", b_pstruct },
+    { "Passed pawns", b_passed }, { "Castling", b_castle }, { "Development", b_dev }, { "Scale", b_scale },
+    { "Phase", b_phase }, { "blended_eval", b_blended },
+  };
+  init_attack_tables();
+  init_pesto_tables();
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    exit(1);
+  }
+  board **pos = malloc(sizeof(board *) * BENCH_MAX_POS);
+  attack_info_t *ai = malloc(sizeof(attack_info_t) * BENCH_MAX_POS);
+  if (!pos || !ai) {
+    fprintf(stderr, "Alloc failed\n");
+    exit(1);
+  }
+  char line[256];
+  int n = 0;
+  while (n < BENCH_MAX_POS && fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (!line[0]) continue;
+    pos[n] = init_board();
+    if (!load_fen(pos[n], line)) {
+      fprintf(stderr, "Skipping bad FEN: %s\n", line);
+      free_board(pos[n]);
+      continue;
+    }
+    compute_attacks(pos[n], &ai[n]);
+    ++n;
+  }
+  fclose(f);
+  if (!n) {
+    fprintf(stderr, "No positions in %s\n", path);
+    exit(1);
+  }
+
+  int reps = BENCH_EVALS / n + 1;
+  volatile int sink = 0;
+  printf("%d positions, %d evals per term\n", n, reps * n);
+  for (size_t t = 0; t < sizeof(terms) / sizeof(terms[0]); ++t) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int r = 0; r < reps; ++r)
+      for (int i = 0; i < n; ++i)
+        sink += terms[t].fn(pos[i], &ai[i]);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("%-16s %8.2f ns\n", terms[t].name, ns / ((double)reps * n));
+  }
+  for (int i = 0; i < n; ++i) free_board(pos[i]);
+  free(pos);
+  free(ai);
+}
+#endif
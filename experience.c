@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lib/experience.h"
+
+static int exp_fd = -1;
+static const uint8_t *exp_map = NULL; // whole file, read only
+static size_t exp_map_size = 0;
+static uint64_t exp_count = 0; // records indexed so far
+static uint32_t *exp_index = NULL; // open addressing, record + 1, 0 empty
+static uint64_t exp_index_size = 0; // power of 2, at least 2 * exp_count
+
+static inline const exp_record_t *exp_rec(uint64_t i) {
+  return (const exp_record_t *)(exp_map + sizeof(exp_header_t)) + i;
+}
+
+static void exp_index_put(uint32_t r) { // keep the deepest record per key, later wins ties
+  uint64_t mask = exp_index_size - 1;
+  const exp_record_t *rec = exp_rec(r);
+  for (uint64_t h = (rec->key * 0x9e3779b97f4a7c15ULL) >> 20 & mask;; h = (h + 1) & mask) {
+    if (!exp_index[h]) {
+      exp_index[h] = r + 1;
+      return;
+    }
+    const exp_record_t *old = exp_rec(exp_index[h] - 1);
+    if (old->key == rec->key) {
+      if (rec->depth >= old->depth) exp_index[h] = r + 1;
+      return;
+    }
+  }
+}
+
+static int exp_remap(void) { // map new records appended by anyone, caller holds at least a shared lock
+  struct stat st;
+  if (fstat(exp_fd, &st) < 0) return 0;
+  size_t size = (size_t)st.st_size;
+  if (size < sizeof(exp_header_t)) return 1; // empty, header written by the first append
+  uint64_t count = (size - sizeof(exp_header_t)) / sizeof(exp_record_t);
+  if (count == exp_count && exp_map) return 1;
+
+  if (exp_map) munmap((void *)exp_map, exp_map_size);
+  exp_map = mmap(NULL, size, PROT_READ, MAP_SHARED, exp_fd, 0);
+  if (exp_map == MAP_FAILED) {
+    exp_map = NULL;
+    exp_map_size = exp_count = 0;
+    return 0;
+  }
+  exp_map_size = size;
+
+  const exp_header_t *h = (const exp_header_t *)exp_map;
+  if (h->magic != EXP_MAGIC || h->record_size != sizeof(exp_record_t)) {
+    fprintf(stderr, "WARNING: experience file has a bad header, ignoring it.\n");
+    munmap((void *)exp_map, exp_map_size);
+    exp_map = NULL;
+    exp_map_size = exp_count = 0;
+    return 0;
+  }
+
+  if (count * 2 > exp_index_size) { // grow and rebuild
+    uint64_t n = 1024;
+    while (n < count * 2) n <<= 1;
+    uint32_t *idx = calloc(n, sizeof(uint32_t));
+    if (!idx) return 0;
+    free(exp_index);
+    exp_index = idx;
+    exp_index_size = n;
+    exp_count = 0;
+  }
+  for (uint64_t i = exp_count; i < count; ++i)
+    exp_index_put((uint32_t)i);
+  exp_count = count;
+  return 1;
+}
+
+int exp_open(const char *path) {
+  exp_close();
+  exp_fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0644);
+  if (exp_fd < 0) return 0;
+  flock(exp_fd, LOCK_SH);
+  int ok = exp_remap();
+  flock(exp_fd, LOCK_UN);
+  if (!ok) {
+    exp_close();
+    return 0;
+  }
+  return 1;
+}
+
+void exp_close(void) {
+  if (exp_map) munmap((void *)exp_map, exp_map_size);
+  if (exp_fd >= 0) close(exp_fd);
+  free(exp_index);
+  exp_fd = -1;
+  exp_map = NULL;
+  exp_map_size = exp_count = exp_index_size = 0;
+  exp_index = NULL;
+}
+
+int exp_ready(void) {
+  return exp_fd >= 0;
+}
+
+int exp_lookup(uint64_t key, exp_record_t *out) {
+  if (!exp_count) return 0;
+  uint64_t mask = exp_index_size - 1;
+  for (uint64_t h = (key * 0x9e3779b97f4a7c15ULL) >> 20 & mask; exp_index[h]; h = (h + 1) & mask) {
+    const exp_record_t *rec = exp_rec(exp_index[h] - 1);
+    if (rec->key == key) {
+      *out = *rec;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void exp_append(uint64_t key, uint16_t move, int score, int depth, int white) {
+  if (exp_fd < 0) return;
+  exp_record_t rec = { .key = key, .move = move, .score = (int16_t)score, .depth = (uint8_t)depth, .white = (uint8_t)(white != 0), .pad = 0 };
+
+  flock(exp_fd, LOCK_EX); // whole record lands before anyone maps it
+  struct stat st;
+  if (fstat(exp_fd, &st) == 0 && st.st_size == 0) {
+    exp_header_t h = { .magic = EXP_MAGIC, .record_size = sizeof(exp_record_t), .reserved = 0 };
+    if (write(exp_fd, &h, sizeof(h)) != sizeof(h)) fprintf(stderr, "WARNING: experience header write failed.\n");
+  }
+  if (write(exp_fd, &rec, sizeof(rec)) != sizeof(rec)) fprintf(stderr, "WARNING: experience write failed.\n");
+  exp_remap();
+  flock(exp_fd, LOCK_UN);
+}
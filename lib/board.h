@@ -62,6 +62,7 @@ struct board_header {
   uint64_t blacks;
   uint8_t castle;
   uint8_t cc; // castle completed
+  struct nnue_stack *nnue; // NULL unless NNUE evaluation is attached
 };
 
 struct snapshot_header {
@@ -93,6 +94,14 @@ typedef struct {
   int promo; // 0 no promotion
 } undo_t;
 
+typedef struct {
+  uint64_t by_type[2][NUM_PIECES]; // [side][piece] squares attacked, side 1 = white
+  uint64_t all[2]; // every square attacked by side
+  uint64_t moves[2]; // pseudo-legal targets: pawn pushes, no own-piece squares
+  uint64_t king_zone[2]; // squares around side's king
+  uint64_t checkers[2]; // opposing pieces attacking side's king
+} attack_info_t;
+
 typedef struct board_header board;
 typedef struct snapshot_header board_snapshot;
 
@@ -128,7 +137,7 @@ uint64_t queen(uint64_t blockers, int square);
 uint64_t circle(int square);
 int piece_at(const board *B, int square);
 int movegen(board *B, int white, move_t **move_list, int check_legal);
-int movegen_ply(board *B, int white, int check_legal, int ply, move_t **out, move_t (*move_stack)[MAX_MOVES], int max_moves);
+int movegen_ply(board *B, int white, int check_legal, int ply, move_t **out, move_t (*move_stack)[MAX_MOVES], int max_moves, const attack_info_t *ai); // ai may be NULL
 board *clone(board *B);
 uint64_t sided_passed_pawns(uint64_t friend, uint64_t opp, int white);
 int value(int piece);
@@ -138,13 +147,13 @@ void make_move(board *B, const move_t *m, int white, undo_t *u);
 void unmake_move(board *B, const move_t *m, int white, const undo_t *u);
 uint64_t hash_board(const board *B);
 uint64_t hash_snapshot(const board_snapshot* S);
+uint64_t position_key(const board *B); // deterministic Zobrist key, for experience and book files
+int insufficient_material(const board *B);
 void save_snapshot(const board *B, board_snapshot *S);
 void restore_snapshot(board *B, const board_snapshot *S);
 int check(const board *B, int side);
+void compute_attacks(const board *B, attack_info_t *ai); // once per node, shared by eval, castling and check
 void load_position(board *B, const uint64_t *WHITE, const uint64_t *BLACK, int white, uint8_t castle, u_int8_t cc);
-static inline uint64_t white_attacks(const board *B);
-static inline uint64_t black_attacks(const board *B);
-static inline void add_castles(board *B, int white, move_t **list, int *count, int *max_moves);
-static inline void add_castles_nalloc(board *B, int white, move_t *list, int *count, int max_moves);
-int square_attacker(const board *B_in, int square, int by_black);
+static inline void add_castles(board *B, int white, move_t **list, int *count, int *max_moves, const attack_info_t *ai);
+static inline void add_castles_nalloc(board *B, int white, move_t *list, int *count, int max_moves, const attack_info_t *ai);
 void apply_promotion(board *B, int side, int to, int newp);
\ No newline at end of file
@@ -7,12 +7,15 @@
 #include "board.h"
 #include "tt.h"
 #include "see.h"
+#include "params.h"
 
 #define BOARD_SIZE (64)
 #define MATE (32000)
 
 #define TT_ENABLED (1)
-#define TT_SIZE_MB (64)  // size in MB
+#define EXPERIENCE_ENABLED (1) // consult and extend the experience file when one is open
+#define BOOK_ENABLED (1) // probe the mapped book at the root
+#define BOOK_MIN_GAMES (10) // fewer games through the root only orders the book moves first
 #define OUTPUT_LINES (1)
 #define NODE_CHECK (2047)
 #define MAX_PLY (128)
@@ -24,80 +27,146 @@
 #define ROOT_QUIESCENCE_ENABLED (1)
 
 #define LMR_ENABLED (1)
-#define LMR_MIN_DEPTH (3)
-#define LMR_BASE_REDUCTION (1)
+#define LMR_TABLE_SIZE (64) // depth and move index clamp here
+#define LMR_DIVISOR (2.25) // R = LMR_BASE_REDUCTION + log(depth) * log(move) / LMR_DIVISOR
+#define LMR_HISTORY_DIV (8192) // summed quiet history per ply of reduction removed
+#define LMR_STAT_BUCKETS (6) // re-search rate by reduction, DEBUG builds
+
+#define HISTORY_MAX (16384) // gravity bound of every history entry
+#define HISTORY_BONUS(depth) ((depth) * (depth) * 32 < 2000 ? (depth) * (depth) * 32 : 2000)
+#define MAX_QUIETS (64) // quiets per node penalised on a cutoff
+#define MAX_CAPTURES (32) // captures per node penalised on a cutoff
+#define CAPT_HIST_ORDER_DIV (16) // capture history per ordering point, below one mvv_lva step
+#define CAPT_HIST_SEE_DIV (64) // capture history per centipawn of SEE pruning slack
 
 #define NMP_ENABLED (1)
-#define NMP_MIN_DEPTH (3)
-#define NMP_BASE_REDUCTION (2)
 #define NMP_EXTRA_REDUCTION(depth) ((depth) / 3)
-#define NMP_MARGIN (2 * PAWN_VALUE) // stand eval above beta by margin
 
 #define LMP_ENABLED (1)
-#define LMP_MAX_DEPTH (3) // only shallow depth
-#define LMP_SKIP_BASE (3) // skip quiet moves after 8th
+
+#define RFP_ENABLED (1) // reverse futility, static eval far past beta
+#define HIST_PRUNE_ENABLED (1) // late quiets with bad history at low depth
+
+#define PROBCUT_ENABLED (1) // good captures that beat beta by a margin at reduced depth cut the node
+#define PROBCUT_REDUCTION (4)
 
 #define FUT_ENABLED (0)
-#define FUT_NODE_MAX_DEPTH (2) // depth <= []
-#define FUT_BASE_MARGIN (2 * PAWN_VALUE) // base fut margin
-#define FUT_MOVE_MAX_DEPTH (3)
-#define FUT_MOVE_MARGIN (1 * PAWN_VALUE) // quite move margin
 
 #define DELTA_PRUNE_ENABLED (1)
-#define DELTA_MARGIN SEE_PAWN // delta margin in centipawns
 
 #define RAZOR_ENABLED (1)
-#define RAZOR_MAX_DEPTH (2) // only depth 1–2
-#define RAZOR_MARGIN1 (1 * PAWN_VALUE) // first stage
-#define RAZOR_MARGIN2 (2 * PAWN_VALUE)
+
+#define IIR_ENABLED (1) // one ply less for PV and cut nodes without a TT move
+#define IIR_MIN_DEPTH (4)
+#define IID_ENABLED (0) // shallower search of PV nodes without a TT move to find one, instead of IIR
+#define IID_MIN_DEPTH (8)
+#define IID_REDUCTION (2)
 
 #define PVS_ENABLED (1)
-#define WINDOW_IS_PV(alpha, beta) ((beta) - (alpha) > 1)
+#define WINDOW_IS_PV(alpha, beta) ((int64_t)(beta) - (alpha) > 1) // 64 bit, the root window is INT32_MIN to INT32_MAX
 
 #define CAPPRUNE_ENABLED (1) // quiescence capture pruning
 
 #define CHECK_EXTENSION_ENABLED (1)
 #define CHECK_EXTENSION (1) // extend by 1 ply
 
-#define SEE_PRUNE_DEPTH (3) // prune bad captures to depth
-#define SEE_PRUNE_MARGIN SEE_PAWN // prune if SEE < -margin * depth
+#define SE_ENABLED (1) // singular extensions and multi-cut
+#define SE_EXTENSION (1)
+#define SE_TT_DEPTH (3) // TT entry at most this much shallower than the node
+
+#define NO_EVAL (INT32_MIN) // search stack entry of a node in check
+
+// margins and depth limits are in params.h, read through PARAM()
 
 struct bot_header {
   board *B;
   int white;
   int depth;
   int limit;
+  long node_limit; // stop after this many nodes, 0 for none
+  int quiet; // no per-depth output
+  int use_book; // consult the book and experience at the root
+  int score; // last find_move score, white positive, 0 after a book move
 };
 
 typedef struct bot_header bot;
 
-extern move_t pv_table[MAX_PLY][MAX_PLY];
-extern int pv_length[MAX_PLY];
-
-extern move_t move_stack[MAX_PLY][MAX_MOVES];
-extern move_t qmove_stack[MAX_QPLY][MAX_MOVES];
-extern move_t last_move[MAX_PLY];
-extern move_t counter_move[2][64][64]; // best reply side, from, to
-
-static double deadline;
-static long nodes;
-static int time_flag;
-
-static move_t killer1[MAX_PLY];
-static move_t killer2[MAX_PLY];
-static int history_tbl[2][NUM_PIECES][64]; // side, piece, to
-static int mvv_lva[NUM_PIECES][NUM_PIECES]; // mvvlva table
+typedef struct { // per ply state of the current line
+  int static_eval; // white POV, NO_EVAL in check
+  uint16_t excluded; // TT move left out by a singular search, 0 for none
+  uint64_t hash; // set by the parent's move loop for the child it is searching, 0 to hash here
+} search_frame_t;
+
+typedef struct { // move ordering history an engine keeps from one search to the next
+  int quiet[2][NUM_PIECES][64]; // side, piece, to
+  int capt[2][NUM_PIECES][64][NUM_PIECES]; // side, piece, to, captured
+  int16_t cont[2][2][NUM_PIECES][64][NUM_PIECES][64]; // plies back - 1, side, prev piece, prev to, piece, to
+} search_hist_t;
+
+typedef struct { // everything a search carries over, one per engine when two share a thread
+  tt_table_t *tt;
+  qtt_table_t *qtt;
+  search_hist_t *hist;
+} search_ctx_t;
+
+#ifdef DEBUG
+typedef struct {
+  long lmr_tried[LMR_STAT_BUCKETS]; // reduced searches by reduction, last bucket and up
+  long lmr_research[LMR_STAT_BUCKETS]; // of those, failed high and searched again
+  long se_tried, se_extended, se_multi_cut; // singular searches and their outcomes
+  long probcut_tried, probcut_cut; // captures searched by ProbCut, nodes it cut
+  long tt_nodes[3], tt_missing[3]; // PV, cut and all nodes searching moves, and those without a TT move
+} search_stats_t;
+#define STAT(...) do { __VA_ARGS__; } while (0)
+#else
+#define STAT(...) ((void)0)
+#endif
+
+extern _Thread_local move_t pv_table[MAX_PLY][MAX_PLY];
+extern _Thread_local int pv_length[MAX_PLY];
+
+extern _Thread_local move_t move_stack[MAX_PLY][MAX_MOVES];
+extern _Thread_local move_t qmove_stack[MAX_QPLY][MAX_MOVES];
+extern _Thread_local move_t last_move[MAX_PLY];
+extern _Thread_local move_t counter_move[2][64][64]; // best reply side, from, to
+
+static _Thread_local double deadline;
+static _Thread_local long nodes;
+static _Thread_local int time_flag;
+static _Thread_local long search_nodes; // finished iterations of this find_move
+static _Thread_local long node_budget; // bot->node_limit, 0 for none
+static _Thread_local int root_depth; // current iteration, bounds singular extensions
+
+static _Thread_local move_t killer1[MAX_PLY];
+static _Thread_local move_t killer2[MAX_PLY];
+static _Thread_local search_hist_t *hist; // the thread's own tables unless search_ctx_use picked an engine's
+static _Thread_local int mvv_lva[NUM_PIECES][NUM_PIECES]; // mvvlva table
+static _Thread_local search_frame_t sstack[MAX_PLY];
+static _Thread_local int lmr_table[LMR_TABLE_SIZE][LMR_TABLE_SIZE]; // [depth][move index], log part of the reduction
+#ifdef DEBUG
+static _Thread_local search_stats_t stats;
+#endif
 
 static inline int equals(move_t a, move_t b);
 extern int value(int piece);
 static void init_ordering_tables(void);
+static void init_lmr_table(void);
+static inline int quiet_history(int side, int ply, const move_t *m);
+static void update_quiet_history(int side, int ply, const move_t *m, int bonus);
+static inline int *capture_history(const board *B, int side, const move_t *m);
 static inline int time_over(void);
 bot *init_bot(board *B, int white, int depth, int limit);
 double gtime(void);
-int minimax(board *B, int depth, int max, int alpha, int beta, long *info, int ply);
-int quiesce(board *B, int side, int alpha, int beta, long *info, int qply);
-int oneply_check(board *B, int side, int alpha, int beta, long *info, int ply);
+int minimax(board *B, const attack_info_t *ai, int depth, int max, int alpha, int beta, long *info, int ply, int cut_node);
+int quiesce(board *B, const attack_info_t *ai, int side, int alpha, int beta, long *info, int ply, int qply);
+int oneply_check(board *B, const attack_info_t *ai, int side, int alpha, int beta, long *info, int ply);
+static int book_root(board *B, move_t *moves, int move_count);
+static int experience_root(board *B, move_t *moves, int move_count, int is_white, int depth, uint64_t key, int *score);
 int find_move(bot *bot, int is_white, int limit);
+void search_ctx_init(search_ctx_t *ctx); // tables of tt_size_mb, exits if they can't be allocated
+void search_ctx_clear(search_ctx_t *ctx); // new game, nothing carried over
+void search_ctx_free(search_ctx_t *ctx);
+void search_ctx_use(search_ctx_t *ctx); // searches on this thread use ctx from now on, NULL drops back to no TT and the thread's history
 static inline int is_capture(const board *B, int side_to_move, const move_t *m);
 static inline int victim_square(const board *B, int side_to_move, int sq);
 static void move_sort(move_t *mv, int n);
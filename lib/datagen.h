@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include "board.h"
+
+#define DATAGEN_MAX_THREADS (64)
+#define DATAGEN_BUFFER (8192) // records per thread before a write
+#define DATAGEN_MAX_PLIES (400)
+#define DATAGEN_BOOK_PLIES (8)
+#define DATAGEN_RANDOM_PLIES (4) // uniform random moves after the book, for variety
+#define DATAGEN_HASH_MB (8) // per thread
+#define DATAGEN_MAX_SCORE (2000) // louder positions are not kept
+#define DATAGEN_WIN_SCORE (1500) // adjudicated after DATAGEN_WIN_PLIES plies past this
+#define DATAGEN_WIN_PLIES (6)
+
+typedef struct { // one labelled position, fixed size on disk
+  uint64_t occupancy; // bit per occupied square, A1 = bit 0
+  uint8_t pieces[16]; // PCODE per occupied square in bit order, two per byte, low nibble first
+  int16_t score; // search score, white positive
+  int8_t result; // 1 white won, 0 draw, -1 black won
+  uint8_t flags; // bit 0 white to move, bits 4-7 castle rights
+  uint16_t ply; // game ply
+  uint16_t pad;
+} packed_pos_t;
+
+_Static_assert(sizeof(packed_pos_t) == 32, "packed positions are 32 bytes on disk");
+
+void pack_position(const board *B, int score, int result, int ply, packed_pos_t *out);
+int unpack_position(const packed_pos_t *p, board *B); // 0 if the record is malformed
+int datagen_main(int argc, char **argv); // ./a.out datagen <out> [options], arguments after "datagen"
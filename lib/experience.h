@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include "board.h"
+
+#define EXP_MAGIC (0x31505845u) // "EXP1"
+#define EXP_MIN_DEPTH (6) // shallower searches are not worth keeping
+
+typedef struct {
+  uint32_t magic;
+  uint32_t record_size;
+  uint64_t reserved;
+} exp_header_t;
+
+typedef struct { // one finished find_move, appended in search order
+  uint64_t key; // position_key
+  uint16_t move; // tt_encode_move
+  int16_t score; // white positive, mate relative to this position
+  uint8_t depth; // completed iteration
+  uint8_t white; // side to move
+  uint16_t pad;
+} exp_record_t;
+
+_Static_assert(sizeof(exp_record_t) == 16, "experience records are 16 bytes on disk");
+
+int exp_open(const char *path); // mmap and index, creates the file, 1 on success
+void exp_close(void);
+int exp_ready(void);
+int exp_lookup(uint64_t key, exp_record_t *out); // deepest record for key, 1 if found
+void exp_append(uint64_t key, uint16_t move, int score, int depth, int white); // under flock, picks up other processes' records too
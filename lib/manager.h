@@ -14,12 +14,18 @@
 
 #define GRAPHICS (1) // graphics
 #define OPENING_BOOK (1) // opening book usage
+#define BOOK_FILE "book.bin" // make book
+#define BOOK_CSV "high_elo_opening.csv"
 #define WHITE_BOT (0)
 #define BLACK_BOT (1)
 #define WHITE_DEPTH (15)
 #define BLACK_DEPTH (15)
 #define WHITE_LIMIT (5) // sec
 #define BLACK_LIMIT (10) // sec
+#define NNUE_EVAL (0) // evaluate with NNUE_FILE instead of blended_eval
+#define NNUE_FILE "nn.nnue"
+#define EXPERIENCE (1) // reuse deep results from earlier games
+#define EXPERIENCE_FILE "experience.bin"
 
 // ARRAYS
 
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include "board.h"
+#include "params.h"
+
+#define MATCH_MAX_THREADS (64)
+#define MATCH_MAX_PLIES (400) // longer games are drawn
+#define MATCH_MAX_OPENING (32)
+#define MATCH_BOOK_PLIES (8) // weighted book moves before the engines take over
+#define MATCH_HASH_MB (16) // per engine, per game thread
+#define ADJ_WIN_SCORE (1000) // both engines past this for ADJ_WIN_PLIES plies
+#define ADJ_WIN_PLIES (8)
+#define ADJ_DRAW_SCORE (10) // both engines within this for ADJ_DRAW_PLIES plies
+#define ADJ_DRAW_PLIES (16)
+#define ADJ_DRAW_MIN_PLY (60)
+
+typedef struct {
+  int depth;
+  long nodes; // per move, 0 for none
+  int limit; // seconds per move
+  params_t params; // TUNE builds only
+} match_engine_t;
+
+typedef struct {
+  match_engine_t engine[2]; // A, B
+  int games;
+  int threads;
+  int book_plies;
+  double elo0, elo1, alpha, beta; // SPRT
+} match_options_t;
+
+int match_opening(move_t *out, int plies, uint64_t *rng); // book walk of up to plies moves into out, book opened by the caller
+int match_play(const match_engine_t *engine, const move_t *opening, int len, int a_white); // one game, each engine on its own TT and history, result for engine[0]: 1, 0, -1
+void match_thread_free(void); // the calling thread's per-engine search contexts, once its games are done
+int match_main(int argc, char **argv); // ./a.out match [options], arguments after "match"
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include "board.h"
+
+// HalfKP 41024 -> 256x2 -> 32 -> 32 -> 1, classic .nnue layout
+#define NNUE_VERSION (0x7AF32F16u)
+#define NNUE_PS_END (641) // 10 non-king pieces * 64 squares + 1
+#define NNUE_INPUTS (64 * NNUE_PS_END) // king square * piece square
+#define NNUE_HIDDEN (256) // accumulator size per perspective
+#define NNUE_L1 (32)
+#define NNUE_L2 (32)
+#define NNUE_SHIFT (6) // hidden layer output shift
+#define NNUE_FV_SCALE (16) // output scale
+#define NNUE_PAWN (208) // network pawn value, scaled to centipawns
+#define NNUE_STACK (512) // accumulator stack depth, > MAX_PLY + MAX_QPLY
+#define NNUE_MAX_DIRTY (3) // capture promotion: pawn, promoted piece, victim
+
+typedef struct {
+  int16_t v[2][NNUE_HIDDEN] __attribute__((aligned(64))); // [perspective] 1 = white
+  uint8_t computed[2];
+  uint8_t king_moved[2]; // perspective needs a refresh
+  int ndirty;
+  int8_t dpiece[NNUE_MAX_DIRTY]; // piece type
+  int8_t dcolor[NNUE_MAX_DIRTY]; // 1 = white
+  int8_t dfrom[NNUE_MAX_DIRTY]; // -1 when added
+  int8_t dto[NNUE_MAX_DIRTY]; // -1 when removed
+} nnue_acc_t;
+
+struct nnue_stack {
+  nnue_acc_t acc[NNUE_STACK];
+  int top;
+};
+
+typedef struct nnue_stack nnue_stack_t;
+
+int nnue_load(const char *path); // mmap network, 1 on success
+void nnue_unload(void);
+int nnue_ready(void);
+void nnue_attach(board *B); // enable incremental accumulators on B if a net is loaded
+void nnue_detach(board *B);
+void nnue_reset(board *B); // root changed outside make_move, refresh on next eval
+void nnue_push(board *B, const move_t *m, int side, const undo_t *u); // from make_move
+void nnue_pop(board *B); // from unmake_move
+int nnue_evaluate(const board *B); // centipawns, white positive
@@ -3,6 +3,27 @@
 #include "board.h"
 #include "utils.h"
 #include <stdio.h>
+#include <stdint.h>
+
+#define BOOK_MAGIC (0x314b4f42u) // "BOK1"
+#define BOOK_MAX_PLY (100)
+
+typedef struct {
+  uint32_t magic;
+  uint32_t record_size;
+  uint64_t count;
+} book_header_t;
+
+typedef struct { // one (position, move), sorted by key then move
+  uint64_t key; // position_key without castled flags, side to move set
+  uint16_t move; // tt_encode_move
+  uint16_t weight; // games through the move, relative to the most played move here
+  uint32_t wins; // for the side making the move
+  uint32_t draws;
+  uint32_t losses;
+} book_record_t;
+
+_Static_assert(sizeof(book_record_t) == 24, "book records are 24 bytes on disk");
 
 typedef struct open_node {
   char move[10]; // "e4", "Nf6" etc.
@@ -26,6 +47,19 @@ void free_opening_book();
 int parse_csv_line(FILE *stream, char *buffer, int size);
 int parse_move_string(char *list_str, char **move_array, int max_moves);
 int load_openings(const char *filename);
-open_node *get_book_move(char **move_history, int history_count); // history of moves "e4", "e5", etc: return null or random book move
+open_node *get_book_move(char **move_history, int history_count); // history of moves "e4", "e5", etc: return null or a book move weighted by the mover's wins
 int get_line_info(char **moves, int move_count, const char **out_name);
-void print_tree_stats();
\ No newline at end of file
+void print_tree_stats();
+uint64_t book_key(board *B); // position_key without castled flags, B->white is the side to move
+int book_compile(const char *csv, const char *out); // offline, CSV lines to a sorted binary book
+int book_write(const char *out, book_record_t *recs, size_t n, int min_games); // sort, merge duplicates, drop rare moves, weight
+int book_open(const char *path); // mmap, 1 on success
+void book_close(void);
+int book_ready(void);
+int book_probe(board *B, const book_record_t **out); // binary search, number of records for this position
+uint64_t book_score(const book_record_t *r); // selection weight from popularity and the mover's results
+int book_weights(board *B, const move_t *moves, int count, uint64_t *weights); // per move book_score, returns games through B
+uint64_t book_rand(uint64_t *state); // xorshift64* on a caller owned state, a zero state seeds itself from the clock and its address
+int book_choose(const uint64_t *weights, int count, uint64_t *rng); // weighted random index, -1 if every weight is 0
+int book_init(const char *bin, const char *csv); // compiled book, or the CSV tree if it is missing
+int book_move(board *B, char **move_history, int history_count); // weighted pick, from * 64 + to, or -1 off book
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "board.h"
+#include "see.h"
+
+// packed score: mg in the upper 16 bits, eg in the lower 16 bits
+typedef int32_t score_t;
+#define S(mg, eg) ((score_t)((uint32_t)(mg) << 16) + (eg))
+
+static inline int mg_score(score_t s) { return (int16_t)(uint16_t)((uint32_t)(s + 0x8000) >> 16); }
+static inline int eg_score(score_t s) { return (int16_t)(uint16_t)(uint32_t)s; }
+
+// X(name, default), packed eval weights, file line "NAME mg eg"
+#define SCORE_PARAMS(X) \
+  X(MOBILITY_W, S(2, 1)) \
+  X(CENTER_W, S(5, 2)) \
+  X(KING_SAFETY_W, S(15, 0)) \
+  X(KING_ACTIVITY_W, S(0, 12)) \
+  X(PSTRUCT_W, S(0, 3)) \
+  X(PASSED_W, S(0, 40)) \
+  X(DEV_W, S(5, 0)) \
+  X(CASTLE_W, S(20, 0))
+
+// X(name, default), eval and search integers, file line "NAME value"
+#define INT_PARAMS(X) \
+  X(TEMPO_BONUS, 10) \
+  X(NMP_MIN_DEPTH, 3) \
+  X(NMP_BASE_REDUCTION, 2) \
+  X(NMP_MARGIN, 2 * PAWN_VALUE) \
+  X(LMR_MIN_DEPTH, 3) \
+  X(LMR_BASE_REDUCTION, 1) \
+  X(LMP_MAX_DEPTH, 3) \
+  X(LMP_SKIP_BASE, 3) \
+  X(FUT_NODE_MAX_DEPTH, 2) \
+  X(FUT_BASE_MARGIN, 2 * PAWN_VALUE) \
+  X(FUT_MOVE_MAX_DEPTH, 3) \
+  X(FUT_MOVE_MARGIN, 1 * PAWN_VALUE) \
+  X(DELTA_MARGIN, SEE_PAWN) \
+  X(RAZOR_MAX_DEPTH, 2) \
+  X(RAZOR_MARGIN1, 1 * PAWN_VALUE) \
+  X(RAZOR_MARGIN2, 2 * PAWN_VALUE) \
+  X(SEE_PRUNE_DEPTH, 3) \
+  X(SEE_PRUNE_MARGIN, SEE_PAWN) \
+  X(SE_MIN_DEPTH, 7) \
+  X(SE_MARGIN, 3) \
+  X(RFP_MAX_DEPTH, 6) \
+  X(RFP_MARGIN, 75) \
+  X(HIST_PRUNE_DEPTH, 3) \
+  X(HIST_PRUNE_MARGIN, 8000) \
+  X(PROBCUT_MIN_DEPTH, 5) \
+  X(PROBCUT_MARGIN, 200)
+
+typedef struct {
+#define X(name, def) score_t name;
+  SCORE_PARAMS(X)
+#undef X
+#define X(name, def) int name;
+  INT_PARAMS(X)
+#undef X
+  score_t piece_value[NUM_PIECES]; // file line "VALUE_<piece> mg eg"
+  score_t pst[NUM_PIECES][64]; // white's view, file line "PST_<piece> sq mg eg"
+  score_t psqt[12][64]; // value + pst per PCODE, rebuilt by params_refresh
+} params_t;
+
+#ifdef TUNE
+// TUNE builds read every parameter through the calling thread's set
+extern params_t default_params;
+extern _Thread_local const params_t *params; // &default_params unless a game thread sets its own
+#define PARAM(name) (params->name)
+#define PSQT(pc, sq) (params->psqt[pc][sq])
+#else
+// release builds freeze the defaults as constants
+enum {
+#define X(name, def) PARAM_##name = (def),
+  SCORE_PARAMS(X)
+  INT_PARAMS(X)
+#undef X
+};
+#define PARAM(name) (PARAM_##name)
+#define PSQT(pc, sq) (psqt[pc][sq])
+#endif
+
+void params_init(params_t *p); // defaults from params.h and eval.h
+void params_refresh(params_t *p); // rebuild psqt after editing values or pst
+int params_set(params_t *p, const char *line); // one "NAME ..." line, 1 on success
+int params_load(params_t *p, const char *path); // 1 on success
+void params_save(const params_t *p, FILE *f);
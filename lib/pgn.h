@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include "board.h"
+#include "opening.h"
+
+#define PGN_CHUNK_SIZE (4 << 20) // bytes read per job, cut at a game boundary
+#define PGN_QUEUE_SIZE (16) // chunks waiting for a worker
+#define PGN_MAX_THREADS (64)
+#define PGN_DEFAULT_PLY (24)
+#define PGN_DEFAULT_MIN_GAMES (5)
+#define PGN_START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+typedef struct {
+  int max_ply; // record positions before this ply
+  int min_games; // drop rarer (position, move) pairs
+  int threads; // 0 for one per core
+} pgn_options_t;
+
+int parse_san(board *B, const char *san, const move_t *moves, int count, move_t *out); // match SAN against pseudo-legal moves of B->white, 1 if exactly one is legal
+int pgn_build_book(const char *pgn, const char *out, const pgn_options_t *opt); // stream, replay in parallel, write book_write format
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include "params.h"
+
+#define SPSA_ITERATIONS (2000) // game pairs
+#define SPSA_CHECKPOINT (50) // iterations between parameter files
+#define SPSA_NODES (4000) // per move, fast games
+#define SPSA_DEPTH (24) // nodes end the search first
+#define SPSA_BOOK_PLIES (8)
+#define SPSA_HASH_MB (4) // per engine, per game thread
+#define SPSA_R_END (0.002) // learning rate at the last iteration, relative to c_end squared
+#define SPSA_ALPHA (0.602)
+#define SPSA_GAMMA (0.101)
+
+typedef struct {
+  const char *name;
+  size_t offset; // int field of params_t
+  int min, max;
+  double c_end; // perturbation at the last iteration
+} spsa_param_t;
+
+int spsa_main(int argc, char **argv); // ./a.out spsa <out> [options], TUNE builds only
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include "board.h"
+#include "params.h"
+
+#define TEXEL_MAX_THREADS (64)
+#define TEXEL_EPOCHS (500)
+#define TEXEL_LR (1.0) // Adam step in centipawns
+#define TEXEL_REPORT (25) // epochs between loss lines and checkpoints
+#define TEXEL_MAX_LINE (256)
+
+typedef struct { // one nonzero white-minus-black feature count
+  uint16_t index; // weight, see texel.c
+  int16_t coeff;
+} texel_coeff_t;
+
+typedef struct { // one training position, coefficients live in its shard
+  uint32_t start;
+  uint8_t count;
+  uint8_t phase; // 0 to 24
+  uint8_t scale; // 0 to 64, fixed at load time
+  uint8_t white; // side to move, for the tempo
+  float result; // 1 white won, 0.5 draw, 0 black won
+} texel_entry_t;
+
+typedef struct {
+  int epochs;
+  double lr;
+  int threads; // 0 for one per core
+  const char *start; // parameter file to start from, NULL for the compiled defaults
+} texel_options_t;
+
+int texel_tune(const char *data, const char *out, const texel_options_t *opt); // FEN + result lines, or datagen records for *.bin
@@ -6,7 +6,19 @@
 #include "board.h"
 
 #define TT_DEFAULT_SIZE_MB (64) // 64mb default
-#define TT_BUCKET_SIZE (4) // entries per bucket
+#define TT_CACHE_LINE (64) // one bucket per cache line
+#define TT_HUGE_PAGE (2 * 1024 * 1024)
+#define TT_CLEAR_THREADS (64) // max threads zeroing the table
+#define TT_CLEAR_PARALLEL_MB (64) // smaller tables are zeroed on the caller
+#define TT_HASHFULL_SAMPLE (1000) // buckets sampled by tt_hashfull
+#define QTT_SIZE_KB (512) // quiescence table, sized to stay in L2
+// minimax depths stored in the qtt instead of g_tt. tt_get_move and tt_lookup never see them, a caller
+// after a move at these depths falls back to qtt_get_move, and tt_lookup users (singular extensions) only
+// want entries far deeper than this anyway
+#define QTT_MAX_DEPTH (1)
+#define QTT_DEPTH_OFFSET (1) // qtt depths start at -1, quiescence past its first ply
+#define QTT_NO_EVAL (INT16_MIN) // entry without a static eval
+#define TT_BUCKET_SIZE (4) // 16-byte entries per 64-byte bucket
 
 typedef enum {
   TT_NONE  = 0,
@@ -15,35 +27,61 @@ typedef enum {
   TT_UPPER = 3 // fail-low: upper bound score
 } tt_flag_t;
 
-typedef struct {
-  uint32_t key; // upper 32 bits of hash
-  int16_t score; // eval
-  int16_t eval; // static eval
-  uint16_t move; // best move, 0 none
-  uint8_t depth;
-  uint8_t flag; // bound type and age
+typedef struct { // lock-free: data is written first, then key = hash ^ data, readers check both
+  uint64_t key; // hash ^ data, torn or racing writes fail the check
+  uint64_t data; // move 0-15, score 16-31, eval 32-47, depth 48-55, flag 56-63 (bound 0-1, age 2-7)
 } tt_entry_t;
 
 typedef struct {
   tt_entry_t entries[TT_BUCKET_SIZE];
-} tt_bucket_t;
+} __attribute__((aligned(TT_CACHE_LINE))) tt_bucket_t;
+
+_Static_assert(sizeof(tt_bucket_t) == TT_CACHE_LINE, "tt bucket must fill one cache line");
 
 typedef struct {
   tt_bucket_t *buckets;
   uint64_t num_buckets;
-  uint64_t mask;
+  uint8_t shift; // 64 - log2(num_buckets)
   uint8_t age;
+  uint8_t mapped; // buckets from mmap(MAP_HUGETLB), else aligned_alloc
 } tt_table_t;
 
-extern tt_table_t *g_tt;
+typedef struct { // direct mapped, always replace
+  tt_entry_t *entries;
+  uint64_t num_entries;
+  uint8_t shift;
+} qtt_table_t;
+
+extern _Thread_local tt_table_t *g_tt; // created by the thread that searches
+extern _Thread_local qtt_table_t *g_qtt; // quiescence and depth <= QTT_MAX_DEPTH results
+extern size_t tt_size_mb; // hash size used when g_tt is created
 
 tt_table_t *tt_create(size_t size_mb);
+int tt_resize(tt_table_t *tt, size_t size_mb); // new cleared table, keeps the old one and returns 0 on failure
 void tt_free(tt_table_t *tt);
-void tt_clear(tt_table_t *tt);
+void tt_clear(tt_table_t *tt); // zeroed across threads for large tables
+int tt_hashfull(const tt_table_t *tt); // per mille of sampled entries written this search
 void tt_new_search(tt_table_t *tt);  // increment age
 int tt_probe(tt_table_t *tt, uint64_t hash, int depth, int alpha, int beta, int *score, uint16_t *best_move, int ply); // 1 if hit (fill score, move, flag), 0 miss
 void tt_store(tt_table_t *tt, uint64_t hash, int depth, int score, tt_flag_t flag, uint16_t best_move, int ply);
 uint16_t tt_get_move(tt_table_t *tt, uint64_t hash); // move without probing
+int tt_lookup(tt_table_t *tt, uint64_t hash, int *score, int *depth, tt_flag_t *flag, int ply); // raw entry whatever its depth, 0 if none
+qtt_table_t *qtt_create(size_t size_kb);
+void qtt_free(qtt_table_t *qtt);
+void qtt_clear(qtt_table_t *qtt);
+uint16_t qtt_get_move(qtt_table_t *qtt, uint64_t hash); // move without probing, shallow minimax and quiescence only
+int qtt_probe(qtt_table_t *qtt, uint64_t hash, int depth, int alpha, int beta, int *score, uint16_t *best_move, int *eval, int ply); // 1 if score usable, move and eval filled on any hit
+void qtt_store(qtt_table_t *qtt, uint64_t hash, int depth, int score, tt_flag_t flag, uint16_t best_move, int eval, int ply);
+int tt_stress_test(void); // threads hammering one table, 1 if no read was corrupt
+
+static inline tt_bucket_t *tt_bucket(const tt_table_t *tt, uint64_t hash) { // high bits, the low bits of hash_board only see the low squares
+  // side to move, castling and cc sit in the low bits, so toggling them alone never moves a key to another bucket
+  return &tt->buckets[hash >> tt->shift];
+}
+
+static inline void tt_prefetch(const tt_table_t *tt, uint64_t hash) { // pull the bucket in before tt_probe, pass the full hash that will be probed
+  if (tt) __builtin_prefetch(tt_bucket(tt, hash));
+}
 
 static inline uint16_t tt_encode_move(int from, int to, int promo) {
   // bits: 0-5: from, 6-11: to, 12-15: promo
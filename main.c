@@ -1,10 +1,103 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "lib/magic.h"
 #include "lib/manager.h"
 #include "lib/ui_sdl.h"
 #include "lib/board.h"
+#include "lib/eval.h"
+#include "lib/params.h"
+#include "lib/tt.h"
+#include "lib/opening.h"
+#include "lib/pgn.h"
+#include "lib/match.h"
+#include "lib/datagen.h"
+#include "lib/texel.h"
+#include "lib/spsa.h"
 
-int main() {
+int main(int argc, char **argv) {
+  if (argc > 3 && !strcmp(argv[1], "makebook")) { // ./a.out makebook <csv> <book>
+    init_attack_tables();
+    return book_compile(argv[2], argv[3]) ? 0 : 1;
+  }
+  if (argc > 1 && !strcmp(argv[1], "ttstress")) // ./a.out ttstress, nonzero exit on a corrupt read
+    return tt_stress_test() ? 0 : 1;
+  if (argc > 1 && !strcmp(argv[1], "match")) // ./a.out match [--games n] [--concurrency n] [--depth[-a|-b] d] ...
+    return match_main(argc - 2, argv + 2);
+  if (argc > 2 && !strcmp(argv[1], "datagen")) // ./a.out datagen <out> [--positions n] [--depth d] [--nodes n] ...
+    return datagen_main(argc - 2, argv + 2);
+  if (argc > 2 && !strcmp(argv[1], "spsa")) // ./a.out spsa <out> [--iterations n] [--nodes n] ..., make tune builds
+    return spsa_main(argc - 2, argv + 2);
+  if (argc > 3 && !strcmp(argv[1], "pgnbook")) { // ./a.out pgnbook <pgn> <book> [max ply] [min games] [threads]
+    pgn_options_t opt = { PGN_DEFAULT_PLY, PGN_DEFAULT_MIN_GAMES, 0 };
+    if (argc > 4) opt.max_ply = atoi(argv[4]);
+    if (argc > 5) opt.min_games = atoi(argv[5]);
+    if (argc > 6) opt.threads = atoi(argv[6]);
+    init_attack_tables();
+    return pgn_build_book(argv[2], argv[3], &opt) ? 0 : 1;
+  }
+  if (argc > 3 && !strcmp(argv[1], "texel")) { // ./a.out texel <data> <out params> [epochs] [lr] [threads] [start params]
+    texel_options_t opt = { TEXEL_EPOCHS, TEXEL_LR, 0, NULL };
+    if (argc > 4) opt.epochs = atoi(argv[4]);
+    if (argc > 5) opt.lr = atof(argv[5]);
+    if (argc > 6) opt.threads = atoi(argv[6]);
+    if (argc > 7) opt.start = argv[7];
+    if (opt.epochs < 1 || opt.lr <= 0) {
+      fprintf(stderr, "Bad texel options.\n");
+      return 1;
+    }
+    init_attack_tables();
+    init_pesto_tables();
+    return texel_tune(argv[2], argv[3], &opt) ? 0 : 1;
+  }
+#ifdef EVAL_TRACE
+  if (argc > 2 && !strcmp(argv[1], "trace")) { // ./a.out trace "<fen>"
+    eval_trace_fen(argv[2]);
+    return 0;
+  }
+#endif
+#ifdef EVAL_BENCH
+  if (argc > 2 && !strcmp(argv[1], "evalbench")) { // ./a.out evalbench <fen file>
+    eval_bench(argv[2]);
+    return 0;
+  }
+#endif
+  for (int i = 1; i < argc; ++i) { // --hash <mb>, --params <file>, --set "NAME value", --print-params
+    if (!strcmp(argv[i], "--hash") && i + 1 < argc) {
+      long mb = atol(argv[++i]);
+      if (mb <= 0) {
+        fprintf(stderr, "Bad hash size: %s\n", argv[i]);
+        return 1;
+      }
+      tt_size_mb = (size_t)mb;
+      continue;
+    }
+#ifdef TUNE
+    if (!strcmp(argv[i], "--params") && i + 1 < argc) {
+      init_pesto_tables();
+      if (!params_load(&default_params, argv[++i])) {
+        fprintf(stderr, "Failed to load parameters: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--set") && i + 1 < argc) {
+      init_pesto_tables();
+      if (!params_set(&default_params, argv[++i])) {
+        fprintf(stderr, "Bad parameter: %s\n", argv[i]);
+        return 1;
+      }
+      params_refresh(&default_params);
+    } else if (!strcmp(argv[i], "--print-params")) {
+      init_pesto_tables();
+      params_save(params, stdout);
+      return 0;
+    }
+#else
+    if (!strcmp(argv[i], "--params") || !strcmp(argv[i], "--set") || !strcmp(argv[i], "--print-params")) {
+      fprintf(stderr, "Parameters are compiled in, rebuild with make tune.\n");
+      return 1;
+    }
+#endif
+  }
   start();
   // test_magic_bitboards();
   return 0;
@@ -11,6 +11,8 @@
 #include "lib/ui_sdl.h"
 #include "lib/utils.h"
 #include "lib/opening.h"
+#include "lib/nnue.h"
+#include "lib/experience.h"
 
 int history_len = 0;
 
@@ -25,15 +27,23 @@ void start(void) {
 int run(void) {
   init_attack_tables();
   init_pesto_tables();
-  if (OPENING_BOOK)
-    init_opening_book();
-  if (!load_openings("high_elo_opening.csv")) {
+  if (OPENING_BOOK && !book_init(BOOK_FILE, BOOK_CSV)) {
     fprintf(stderr, "WARNING: failed to load opening book, continuing without it.\n");
   }
+  if (TT_ENABLED && !g_tt) // allocate and fault in the hash before the first move
+    g_tt = tt_create(tt_size_mb);
+  if (TT_ENABLED && !g_qtt)
+    g_qtt = qtt_create(QTT_SIZE_KB);
+  if (EXPERIENCE && !exp_open(EXPERIENCE_FILE))
+    fprintf(stderr, "WARNING: failed to open experience file, continuing without it.\n");
 #ifdef DEBUG
   printf("Initialized attack & pesto tables and opening book.\n");
 #endif
   board *B = init_board();
+  if (NNUE_EVAL) {
+    if (nnue_load(NNUE_FILE)) nnue_attach(B);
+    else fprintf(stderr, "WARNING: failed to load NNUE, using blended eval.\n");
+  }
   // test_position(B); // for testing hardcoded positions
   char input[MAX_INPUT_SIZE];
   int from, to, ply = 0, move = 0, mode = 0;
@@ -65,9 +75,9 @@ int run(void) {
         int type = -1;
 
         if (OPENING_BOOK) {
-          open_node *book_node = get_book_move(move_history, history_len);
-          if (book_node && book_node->move_code >= 0) {
-            best = book_node->move_code;
+          int code = book_move(B, move_history, history_len);
+          if (code >= 0) {
+            best = code;
             from = best / 64;
             to = best % 64;
             type = 0; // opening book
@@ -155,9 +165,9 @@ int run(void) {
         int type = -1;
 
         if (OPENING_BOOK) {
-          open_node *book_node = get_book_move(move_history, history_len);
-          if (book_node && book_node->move_code >= 0) {
-            best = book_node->move_code;
+          int code = book_move(B, move_history, history_len);
+          if (code >= 0) {
+            best = code;
             from = best / 64;
             to = best % 64;
             type = 0; // opening book
@@ -376,33 +386,32 @@ uint64_t imove(int piece, uint64_t from_mask, board *B, int *white) {
   case KING: {
     uint64_t moves = *white ? wk_moves(from_mask, B->whites) : bk_moves(from_mask, B->blacks);
     const uint64_t occ = B->whites | B->blacks;
+    if (!(B->castle & (*white ? (WKS | WQS) : (BKS | BQS)))) return moves;
+    attack_info_t ai;
+    compute_attacks(B, &ai);
     if (*white) { // e1 to castle
-      if (from_mask == (1ULL << E1)) { // e1 to g1 king side
-        if ((B->castle & WKS) && !(occ & ((1ULL << F1) | (1ULL << G1))) &&
-            !check(B, 0) && // not in check
-            !square_attacker(B, F1, 1) && // attacked by black
-            !square_attacker(B, G1, 1)) { // attacked by black
+      const uint64_t opp = ai.all[0]; // attacked by black
+      if (from_mask == (1ULL << E1) && !ai.checkers[1]) { // not in check
+        if ((B->castle & WKS) && !(occ & ((1ULL << F1) | (1ULL << G1))) && // e1 to g1 king side
+            !(opp & ((1ULL << F1) | (1ULL << G1)))) {
           moves |= (1ULL << G1);
         }
         if ((B->castle & WQS) && // e1 to c1 queen side
-            !(occ & ((1ULL << D1) | (1ULL << C1) | (1ULL << B1))) && !check(B, 0) &&
-            !square_attacker(B, D1, 1) &&
-            !square_attacker(B, C1, 1)) {
+            !(occ & ((1ULL << D1) | (1ULL << C1) | (1ULL << B1))) &&
+            !(opp & ((1ULL << D1) | (1ULL << C1)))) {
           moves |= (1ULL << C1);
         }
       }
     } else { // e8 to castle
-      if (from_mask == (1ULL << E8)) { // e8 to g8 king side
-        if ((B->castle & BKS) && !(occ & ((1ULL << F8) | (1ULL << G8))) &&
-            !check(B, 1) &&
-            !square_attacker(B, F8, 0) && // attacked by white
-            !square_attacker(B, G8, 0)) { // attacked by black
+      const uint64_t opp = ai.all[1]; // attacked by white
+      if (from_mask == (1ULL << E8) && !ai.checkers[0]) {
+        if ((B->castle & BKS) && !(occ & ((1ULL << F8) | (1ULL << G8))) && // e8 to g8 king side
+            !(opp & ((1ULL << F8) | (1ULL << G8)))) {
           moves |= (1ULL << G8);
         }
         if ((B->castle & BQS) && // e8 to c8 queen side
-            !(occ & ((1ULL << D8) | (1ULL << C8) | (1ULL << B8))) && !check(B, 1) &&
-            !square_attacker(B, D8, 0) &&
-            !square_attacker(B, C8, 0)) {
+            !(occ & ((1ULL << D8) | (1ULL << C8) | (1ULL << B8))) &&
+            !(opp & ((1ULL << D8) | (1ULL << C8)))) {
           moves |= (1ULL << C8);
         }
       }
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "lib/board.h"
+#include "lib/bot.h"
+#include "lib/eval.h"
+#include "lib/magic.h"
+#include "lib/manager.h"
+#include "lib/opening.h"
+#include "lib/params.h"
+#include "lib/tt.h"
+#include "lib/match.h"
+
+static match_options_t opt;
+static move_t (*openings)[MATCH_MAX_OPENING]; // one per game pair, colors swapped
+static int *opening_len;
+static _Thread_local search_ctx_t engine_ctx[2]; // [engine], TT and history never shared between A and B
+
+static struct {
+  int next, stop;
+  int wins, draws, losses; // for engine A
+  pthread_mutex_t lock;
+} state = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+int match_opening(move_t *out, int plies, uint64_t *rng) { // weighted book walk, random legal moves without a book
+  board *B = init_board();
+  int n = 0;
+  for (int ply = 0; ply < plies && ply < MATCH_MAX_OPENING; ++ply) {
+    move_t *moves;
+    int count = movegen(B, B->white, &moves, 1);
+    int pick = -1;
+    if (book_ready()) {
+      uint64_t weights[MAX_MOVES];
+      book_weights(B, moves, count, weights);
+      pick = book_choose(weights, count, rng);
+    } else if (count) {
+      pick = (int)(book_rand(rng) % count);
+    }
+    if (pick < 0) {
+      free(moves);
+      break;
+    }
+    out[n++] = moves[pick];
+    undo_t u;
+    make_move(B, &moves[pick], B->white, &u);
+    B->white = !B->white;
+    free(moves);
+  }
+  free_board(B);
+  return n;
+}
+
+int match_play(const match_engine_t *engine, const move_t *opening, int len, int a_white) {
+  board *B = init_board();
+  bot *bots[2]; // [engine]
+  for (int e = 0; e < 2; ++e) {
+    bots[e] = init_bot(B, e == 0 ? a_white : !a_white, engine[e].depth, engine[e].limit);
+    bots[e]->node_limit = engine[e].nodes;
+    bots[e]->quiet = 1;
+    bots[e]->use_book = 0;
+  }
+  for (int e = 0; e < 2; ++e) {
+    if (!engine_ctx[e].hist) search_ctx_init(&engine_ctx[e]); // once per game thread
+    search_ctx_clear(&engine_ctx[e]); // nothing carried over from the last game
+  }
+
+  uint64_t keys[MATCH_MAX_OPENING + MATCH_MAX_PLIES + 1];
+  int ply = 0, quiet_plies = 0, win_plies = 0, win_sign = 0, draw_plies = 0;
+  int result = 2; // white POV, 2 while playing
+  keys[0] = position_key(B);
+  for (int i = 0; i < len; ++i) {
+    undo_t u;
+    make_move(B, &opening[i], B->white, &u);
+    B->white = !B->white;
+    keys[++ply] = position_key(B);
+  }
+
+  while (result == 2) {
+    int side = B->white;
+    move_t *moves;
+    int count = movegen(B, side, &moves, 1);
+    if (!count) {
+      result = check(B, !side) ? (side ? -1 : 1) : 0; // mate or stalemate
+      free(moves);
+      break;
+    }
+
+    int e = side == a_white ? 0 : 1;
+#ifdef TUNE
+    params = &engine[e].params;
+#endif
+    search_ctx_use(&engine_ctx[e]);
+    int code = find_move(bots[e], side, engine[e].limit);
+    move_t m = { .from = 255 };
+    for (int i = 0; i < count; ++i) // queen when promoting
+      if (moves[i].from * 64 + moves[i].to == code && (m.from == 255 || moves[i].promo == QUEEN)) m = moves[i];
+    free(moves);
+    if (m.from == 255) {
+      result = side ? -1 : 1; // illegal or no move, forfeit
+      break;
+    }
+
+    int score = bots[e]->score;
+    int sign = score >= ADJ_WIN_SCORE ? 1 : score <= -ADJ_WIN_SCORE ? -1 : 0;
+    win_plies = sign && sign == win_sign ? win_plies + 1 : sign != 0;
+    win_sign = sign;
+    draw_plies = abs(score) <= ADJ_DRAW_SCORE ? draw_plies + 1 : 0;
+
+    undo_t u;
+    make_move(B, &m, side, &u);
+    B->white = !side;
+    quiet_plies = (m.piece == PAWN || u.captured_piece >= 0) ? 0 : quiet_plies + 1;
+    keys[++ply] = position_key(B);
+
+    int reps = 0;
+    for (int i = ply - 2; i >= 0 && i >= ply - quiet_plies; i -= 2)
+      reps += keys[i] == keys[ply];
+    if (reps >= 2 || quiet_plies >= 100 || insufficient_material(B) || ply >= MATCH_MAX_OPENING + MATCH_MAX_PLIES)
+      result = 0;
+    else if (win_plies >= ADJ_WIN_PLIES) // consecutive plies alternate engines, so both agree
+      result = win_sign;
+    else if (draw_plies >= ADJ_DRAW_PLIES && ply >= ADJ_DRAW_MIN_PLY)
+      result = 0;
+  }
+
+#ifdef TUNE
+  params = &default_params;
+#endif
+  search_ctx_use(NULL);
+  free(bots[0]);
+  free(bots[1]);
+  free_board(B);
+  return a_white ? result : -result;
+}
+
+void match_thread_free(void) {
+  for (int e = 0; e < 2; ++e)
+    if (engine_ctx[e].hist) search_ctx_free(&engine_ctx[e]);
+}
+
+static int match_game(int g) { // pairs share an opening with colors swapped
+  return match_play(opt.engine, openings[g / 2], opening_len[g / 2], !(g & 1));
+}
+
+static double elo(double score) {
+  if (score <= 0.001) score = 0.001;
+  if (score >= 0.999) score = 0.999;
+  return -400.0 * log10(1.0 / score - 1.0);
+}
+
+static int match_report(void) { // caller holds the lock, 1 or -1 once SPRT accepts H1 or H0
+  int w = state.wins, d = state.draws, l = state.losses, n = w + d + l;
+  double s = (w + d / 2.0) / n;
+  double var = (w * (1 - s) * (1 - s) + d * (0.5 - s) * (0.5 - s) + l * s * s) / n;
+  double se = sqrt(var / n);
+  double margin = (elo(s + 1.96 * se) - elo(s - 1.96 * se)) / 2;
+  double s0 = 1 / (1 + pow(10, -opt.elo0 / 400)), s1 = 1 / (1 + pow(10, -opt.elo1 / 400));
+  double llr = var > 0 ? n * (s1 - s0) * (2 * s - s0 - s1) / (2 * var) : 0;
+  double lower = log(opt.beta / (1 - opt.alpha)), upper = log((1 - opt.beta) / opt.alpha);
+  printf("Games %d: +%d -%d =%d  score %.1f%%  Elo %.1f +/- %.1f  LLR %.2f [%.2f, %.2f]\n",
+         n, w, l, d, 100 * s, elo(s), margin, llr, lower, upper);
+  fflush(stdout);
+  return llr >= upper ? 1 : llr <= lower ? -1 : 0;
+}
+
+static void *match_worker(void *arg) {
+  (void)arg;
+  for (;;) {
+    pthread_mutex_lock(&state.lock);
+    int g = state.stop || state.next >= opt.games ? -1 : state.next++;
+    pthread_mutex_unlock(&state.lock);
+    if (g < 0) break;
+
+    int r = match_game(g);
+
+    pthread_mutex_lock(&state.lock);
+    if (r > 0) ++state.wins;
+    else if (r < 0) ++state.losses;
+    else ++state.draws;
+    int sprt = match_report();
+    if (sprt && !state.stop) {
+      printf("SPRT: H%d accepted (elo0 %.1f, elo1 %.1f)\n", sprt > 0, opt.elo0, opt.elo1);
+      state.stop = 1;
+    }
+    pthread_mutex_unlock(&state.lock);
+  }
+  match_thread_free();
+  return NULL;
+}
+
+static int engine_arg(const char *name, int argc, char **argv, int *i, int *a, int *b) { // --x sets both, --x-a / --x-b one
+  size_t n = strlen(name);
+  if (strncmp(argv[*i], name, n) || *i + 1 >= argc) return 0;
+  const char *suffix = argv[*i] + n;
+  *a = !*suffix || !strcmp(suffix, "-a");
+  *b = !*suffix || !strcmp(suffix, "-b");
+  if (!*a && !*b) return 0;
+  ++*i;
+  return 1;
+}
+
+int match_main(int argc, char **argv) {
+  init_attack_tables();
+  init_pesto_tables();
+  opt = (match_options_t){ .games = 100, .threads = 0, .book_plies = MATCH_BOOK_PLIES, .elo0 = 0, .elo1 = 5, .alpha = 0.05, .beta = 0.05 };
+  for (int e = 0; e < 2; ++e) {
+    opt.engine[e] = (match_engine_t){ .depth = 6, .nodes = 0, .limit = 10 };
+#ifdef TUNE
+    opt.engine[e].params = default_params;
+#endif
+  }
+  tt_size_mb = MATCH_HASH_MB;
+
+  for (int i = 0; i < argc; ++i) {
+    int a, b;
+    if (!strcmp(argv[i], "--games") && i + 1 < argc) opt.games = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--concurrency") && i + 1 < argc) opt.threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--book-plies") && i + 1 < argc) opt.book_plies = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--hash") && i + 1 < argc) tt_size_mb = (size_t)atol(argv[++i]);
+    else if (!strcmp(argv[i], "--sprt") && i + 2 < argc) {
+      opt.elo0 = atof(argv[++i]);
+      opt.elo1 = atof(argv[++i]);
+    } else if (engine_arg("--depth", argc, argv, &i, &a, &b)) {
+      if (a) opt.engine[0].depth = atoi(argv[i]);
+      if (b) opt.engine[1].depth = atoi(argv[i]);
+    } else if (engine_arg("--nodes", argc, argv, &i, &a, &b)) {
+      if (a) opt.engine[0].nodes = atol(argv[i]);
+      if (b) opt.engine[1].nodes = atol(argv[i]);
+    } else if (engine_arg("--time", argc, argv, &i, &a, &b)) {
+      if (a) opt.engine[0].limit = atoi(argv[i]);
+      if (b) opt.engine[1].limit = atoi(argv[i]);
+    } else if (engine_arg("--params", argc, argv, &i, &a, &b)) {
+#ifdef TUNE
+      for (int e = 0; e < 2; ++e) {
+        if (!(e ? b : a)) continue;
+        if (!params_load(&opt.engine[e].params, argv[i])) {
+          fprintf(stderr, "Failed to load parameters: %s\n", argv[i]);
+          return 1;
+        }
+      }
+#else
+      fprintf(stderr, "Parameters are compiled in, rebuild with make tune.\n");
+      return 1;
+#endif
+    } else {
+      fprintf(stderr, "Unknown match option: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (opt.games < 1 || !tt_size_mb) {
+    fprintf(stderr, "Bad match options.\n");
+    return 1;
+  }
+  int threads = opt.threads > 0 ? opt.threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1) threads = 1;
+  if (threads > MATCH_MAX_THREADS) threads = MATCH_MAX_THREADS;
+
+  if (!book_open(BOOK_FILE))
+    fprintf(stderr, "WARNING: no %s, openings are random legal moves.\n", BOOK_FILE);
+  int pairs = (opt.games + 1) / 2;
+  openings = malloc(pairs * sizeof(*openings));
+  opening_len = malloc(pairs * sizeof(int));
+  if (!openings || !opening_len) {
+    perror("match_main malloc");
+    exit(1);
+  }
+  uint64_t rng = 0;
+  for (int p = 0; p < pairs; ++p)
+    opening_len[p] = match_opening(openings[p], opt.book_plies, &rng);
+
+  printf("Match: %d games on %d threads, A depth %d nodes %ld, B depth %d nodes %ld\n", opt.games, threads,
+         opt.engine[0].depth, opt.engine[0].nodes, opt.engine[1].depth, opt.engine[1].nodes);
+  pthread_t tids[MATCH_MAX_THREADS];
+  for (int t = 0; t < threads; ++t)
+    pthread_create(&tids[t], NULL, match_worker, NULL);
+  for (int t = 0; t < threads; ++t)
+    pthread_join(tids[t], NULL);
+
+  free(openings);
+  free(opening_len);
+  book_close();
+  return 0;
+}
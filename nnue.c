@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lib/board.h"
+#include "lib/nnue.h"
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+typedef struct {
+  const int16_t *ft_bias; // [NNUE_HIDDEN]
+  const int16_t *ft_weight; // [NNUE_INPUTS][NNUE_HIDDEN]
+  int32_t b1[NNUE_L1] __attribute__((aligned(64)));
+  int8_t w1[NNUE_L1][2 * NNUE_HIDDEN] __attribute__((aligned(64))); // [out][in]
+  int32_t b2[NNUE_L2] __attribute__((aligned(64)));
+  int8_t w2[NNUE_L2][NNUE_L1] __attribute__((aligned(64)));
+  int32_t b3;
+  int8_t w3[NNUE_L2] __attribute__((aligned(64)));
+  void *map; // mmap of the whole file
+  size_t map_size;
+  int16_t *copy; // aligned copy when the mapped transformer is misaligned
+} nnue_net_t;
+
+static nnue_net_t *net = NULL;
+
+static inline uint32_t read_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int nnue_load(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror("nnue open");
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < 12) {
+    close(fd);
+    return 0;
+  }
+  size_t size = (size_t)st.st_size;
+  uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("nnue mmap");
+    return 0;
+  }
+
+  uint32_t desc = read_u32(map + 8);
+  size_t ft_off = 12 + (size_t)desc + 4; // skip transformer hash
+  size_t ft_bytes = sizeof(int16_t) * (NNUE_HIDDEN + (size_t)NNUE_INPUTS * NNUE_HIDDEN);
+  size_t net_off = ft_off + ft_bytes + 4; // skip network hash
+  size_t net_bytes = sizeof(int32_t) * NNUE_L1 + NNUE_L1 * 2 * NNUE_HIDDEN + sizeof(int32_t) * NNUE_L2 + NNUE_L2 * NNUE_L1 + sizeof(int32_t) + NNUE_L2;
+
+  if (read_u32(map) != NNUE_VERSION || net_off + net_bytes != size) {
+    fprintf(stderr, "nnue: %s is not a HalfKP 256x2-32-32 network\n", path);
+    munmap(map, size);
+    return 0;
+  }
+
+  nnue_net_t *n = aligned_alloc(64, (sizeof(nnue_net_t) + 63) & ~(size_t)63);
+  if (!n) {
+    munmap(map, size);
+    return 0;
+  }
+  memset(n, 0, sizeof(*n));
+  n->map = map;
+  n->map_size = size;
+  madvise(map, size, MADV_WILLNEED);
+
+  if ((ft_off & 1) == 0) { // int16 aligned, use the mapping in place
+    n->ft_bias = (const int16_t *)(map + ft_off);
+    n->ft_weight = n->ft_bias + NNUE_HIDDEN;
+  } else {
+    n->copy = aligned_alloc(64, (ft_bytes + 63) & ~(size_t)63);
+    if (!n->copy) {
+      munmap(map, size);
+      free(n);
+      return 0;
+    }
+    memcpy(n->copy, map + ft_off, ft_bytes);
+    n->ft_bias = n->copy;
+    n->ft_weight = n->copy + NNUE_HIDDEN;
+  }
+
+  const uint8_t *p = map + net_off; // small layers, copied aligned
+  for (int i = 0; i < NNUE_L1; ++i, p += 4) n->b1[i] = (int32_t)read_u32(p);
+  memcpy(n->w1, p, sizeof(n->w1)); p += sizeof(n->w1);
+  for (int i = 0; i < NNUE_L2; ++i, p += 4) n->b2[i] = (int32_t)read_u32(p);
+  memcpy(n->w2, p, sizeof(n->w2)); p += sizeof(n->w2);
+  n->b3 = (int32_t)read_u32(p); p += 4;
+  memcpy(n->w3, p, sizeof(n->w3));
+
+  nnue_unload();
+  net = n;
+  printf("NNUE: loaded %s (%zu KB)\n", path, size / 1024);
+  return 1;
+}
+
+void nnue_unload(void) {
+  if (!net) return;
+  munmap(net->map, net->map_size);
+  free(net->copy);
+  free(net);
+  net = NULL;
+}
+
+int nnue_ready(void) {
+  return net != NULL;
+}
+
+void nnue_attach(board *B) {
+  if (!net || B->nnue) return;
+  B->nnue = aligned_alloc(64, (sizeof(nnue_stack_t) + 63) & ~(size_t)63);
+  if (!B->nnue) {
+    fprintf(stderr, "Alloc failed\n");
+    exit(1);
+  }
+  nnue_reset(B);
+}
+
+void nnue_detach(board *B) {
+  free(B->nnue);
+  B->nnue = NULL;
+}
+
+void nnue_reset(board *B) {
+  if (!B->nnue) return;
+  B->nnue->top = 0;
+  B->nnue->acc[0].computed[0] = B->nnue->acc[0].computed[1] = 0;
+  B->nnue->acc[0].ndirty = 0;
+}
+
+static inline void add_dirty(nnue_acc_t *a, int pt, int color, int from, int to) {
+  a->dpiece[a->ndirty] = (int8_t)pt;
+  a->dcolor[a->ndirty] = (int8_t)color;
+  a->dfrom[a->ndirty] = (int8_t)from;
+  a->dto[a->ndirty] = (int8_t)to;
+  ++a->ndirty;
+}
+
+void nnue_push(board *B, const move_t *m, int side, const undo_t *u) { // records deltas only, applied lazily
+  nnue_stack_t *S = B->nnue;
+  if (S->top + 1 >= NNUE_STACK) {
+    fprintf(stderr, "NNUE stack overflow\n");
+    abort();
+  }
+  nnue_acc_t *a = &S->acc[++S->top];
+  a->computed[0] = a->computed[1] = 0;
+  a->king_moved[0] = a->king_moved[1] = 0;
+  a->ndirty = 0;
+
+  if (m->piece == KING) { // kings are not features, only the mover's perspective changes
+    a->king_moved[side] = 1;
+    if ((m->from / 8 == m->to / 8) && abs(m->to - m->from) == 2) {
+      int kside = m->to > m->from;
+      int base = side ? 0 : 56;
+      add_dirty(a, ROOK, side, base + (kside ? 7 : 0), base + (kside ? 5 : 3));
+    }
+  } else if (m->promo != 0) {
+    add_dirty(a, PAWN, side, m->from, -1);
+    add_dirty(a, m->promo, side, -1, m->to);
+  } else {
+    add_dirty(a, m->piece, side, m->from, m->to);
+  }
+
+  if (u->captured_piece >= 0 && u->captured_piece != KING) {
+    add_dirty(a, u->captured_piece, !side, u->captured_square, -1);
+  }
+}
+
+void nnue_pop(board *B) {
+  --B->nnue->top;
+}
+
+static inline int orient(int persp, int sq) {
+  return persp ? sq : sq ^ 63;
+}
+
+static inline int feature(int persp, int ksq, int pt, int color, int sq) {
+  return orient(persp, sq) + 1 + pt * 128 + (color == persp ? 0 : 64) + NNUE_PS_END * ksq;
+}
+
+// int16 accumulator kernels
+
+static inline void vec_copy(int16_t *dst, const int16_t *src) {
+  memcpy(dst, src, sizeof(int16_t) * NNUE_HIDDEN);
+}
+
+static inline void vec_add(int16_t *acc, const int16_t *w) {
+#if defined(__AVX2__)
+  for (int j = 0; j < NNUE_HIDDEN; j += 16) {
+    __m256i a = _mm256_load_si256((const __m256i *)(acc + j));
+    _mm256_store_si256((__m256i *)(acc + j), _mm256_add_epi16(a, _mm256_loadu_si256((const __m256i *)(w + j))));
+  }
+#elif defined(__SSE4_1__)
+  for (int j = 0; j < NNUE_HIDDEN; j += 8) {
+    __m128i a = _mm_load_si128((const __m128i *)(acc + j));
+    _mm_store_si128((__m128i *)(acc + j), _mm_add_epi16(a, _mm_loadu_si128((const __m128i *)(w + j))));
+  }
+#else
+  for (int j = 0; j < NNUE_HIDDEN; ++j) acc[j] += w[j];
+#endif
+}
+
+static inline void vec_sub(int16_t *acc, const int16_t *w) {
+#if defined(__AVX2__)
+  for (int j = 0; j < NNUE_HIDDEN; j += 16) {
+    __m256i a = _mm256_load_si256((const __m256i *)(acc + j));
+    _mm256_store_si256((__m256i *)(acc + j), _mm256_sub_epi16(a, _mm256_loadu_si256((const __m256i *)(w + j))));
+  }
+#elif defined(__SSE4_1__)
+  for (int j = 0; j < NNUE_HIDDEN; j += 8) {
+    __m128i a = _mm_load_si128((const __m128i *)(acc + j));
+    _mm_store_si128((__m128i *)(acc + j), _mm_sub_epi16(a, _mm_loadu_si128((const __m128i *)(w + j))));
+  }
+#else
+  for (int j = 0; j < NNUE_HIDDEN; ++j) acc[j] -= w[j];
+#endif
+}
+
+static void refresh(const board *B, nnue_acc_t *a, int persp) {
+  int16_t *acc = a->v[persp];
+  int ksq = orient(persp, __builtin_ctzll(persp ? B->WHITE[KING] : B->BLACK[KING]));
+  vec_copy(acc, net->ft_bias);
+  for (int color = 0; color < 2; ++color) {
+    const uint64_t *P = color ? B->WHITE : B->BLACK;
+    for (int pt = PAWN; pt < KING; ++pt) {
+      uint64_t bb = P[pt];
+      while (bb) {
+        int sq = __builtin_ctzll(bb);
+        bb &= bb - 1;
+        vec_add(acc, net->ft_weight + (size_t)feature(persp, ksq, pt, color, sq) * NNUE_HIDDEN);
+      }
+    }
+  }
+  a->computed[persp] = 1;
+}
+
+static void update(const board *B, nnue_stack_t *S, int persp) {
+  int top = S->top;
+  int i = top;
+  while (!S->acc[i].computed[persp]) { // nearest computed ancestor
+    if (i == 0 || S->acc[i].king_moved[persp]) {
+      refresh(B, &S->acc[top], persp);
+      return;
+    }
+    --i;
+  }
+
+  int ksq = orient(persp, __builtin_ctzll(persp ? B->WHITE[KING] : B->BLACK[KING])); // unchanged since i
+  for (int j = i + 1; j <= top; ++j) {
+    nnue_acc_t *a = &S->acc[j];
+    int16_t *acc = a->v[persp];
+    vec_copy(acc, S->acc[j - 1].v[persp]);
+    for (int d = 0; d < a->ndirty; ++d) {
+      if (a->dfrom[d] >= 0)
+        vec_sub(acc, net->ft_weight + (size_t)feature(persp, ksq, a->dpiece[d], a->dcolor[d], a->dfrom[d]) * NNUE_HIDDEN);
+      if (a->dto[d] >= 0)
+        vec_add(acc, net->ft_weight + (size_t)feature(persp, ksq, a->dpiece[d], a->dcolor[d], a->dto[d]) * NNUE_HIDDEN);
+    }
+    a->computed[persp] = 1;
+  }
+}
+
+// int8 hidden layer kernels
+
+static void transform(const nnue_acc_t *a, int stm, uint8_t *out) { // clamp to [0, 127], side to move first
+  const int16_t *half[2] = { a->v[stm], a->v[!stm] };
+  for (int h = 0; h < 2; ++h) {
+    const int16_t *in = half[h];
+    uint8_t *o = out + h * NNUE_HIDDEN;
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    for (int j = 0; j < NNUE_HIDDEN; j += 32) {
+      __m256i x = _mm256_load_si256((const __m256i *)(in + j));
+      __m256i y = _mm256_load_si256((const __m256i *)(in + j + 16));
+      __m256i p = _mm256_max_epi8(_mm256_packs_epi16(x, y), zero);
+      _mm256_store_si256((__m256i *)(o + j), _mm256_permute4x64_epi64(p, 0xD8)); // undo lane interleave
+    }
+#elif defined(__SSE4_1__)
+    const __m128i zero = _mm_setzero_si128();
+    for (int j = 0; j < NNUE_HIDDEN; j += 16) {
+      __m128i x = _mm_load_si128((const __m128i *)(in + j));
+      __m128i y = _mm_load_si128((const __m128i *)(in + j + 8));
+      _mm_store_si128((__m128i *)(o + j), _mm_max_epi8(_mm_packs_epi16(x, y), zero));
+    }
+#else
+    for (int j = 0; j < NNUE_HIDDEN; ++j) {
+      int v = in[j];
+      o[j] = (uint8_t)(v < 0 ? 0 : v > 127 ? 127 : v);
+    }
+#endif
+  }
+}
+
+static inline int32_t dot_u8i8(const uint8_t *in, const int8_t *w, int n) { // n multiple of 32
+#if defined(__AVX2__)
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i sum = _mm256_setzero_si256();
+  for (int j = 0; j < n; j += 32) {
+    __m256i p = _mm256_maddubs_epi16(_mm256_load_si256((const __m256i *)(in + j)), _mm256_load_si256((const __m256i *)(w + j)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(p, ones));
+  }
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+  return _mm_cvtsi128_si32(s);
+#elif defined(__SSE4_1__)
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i sum = _mm_setzero_si128();
+  for (int j = 0; j < n; j += 16) {
+    __m128i p = _mm_maddubs_epi16(_mm_load_si128((const __m128i *)(in + j)), _mm_load_si128((const __m128i *)(w + j)));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(p, ones));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+  return _mm_cvtsi128_si32(sum);
+#else
+  int32_t sum = 0;
+  for (int j = 0; j < n; ++j) sum += (int32_t)in[j] * w[j];
+  return sum;
+#endif
+}
+
+static inline void affine_relu(const uint8_t *in, int n_in, const int32_t *bias, const int8_t *w, int n_out, uint8_t *out) {
+  for (int i = 0; i < n_out; ++i) {
+    int32_t v = (bias[i] + dot_u8i8(in, w + (size_t)i * n_in, n_in)) >> NNUE_SHIFT;
+    out[i] = (uint8_t)(v < 0 ? 0 : v > 127 ? 127 : v);
+  }
+}
+
+int nnue_evaluate(const board *B) {
+  nnue_stack_t *S = B->nnue;
+  update(B, S, 1);
+  update(B, S, 0);
+
+  uint8_t in[2 * NNUE_HIDDEN] __attribute__((aligned(64)));
+  uint8_t h1[NNUE_L1] __attribute__((aligned(64)));
+  uint8_t h2[NNUE_L2] __attribute__((aligned(64)));
+  transform(&S->acc[S->top], B->white, in);
+  affine_relu(in, 2 * NNUE_HIDDEN, net->b1, &net->w1[0][0], NNUE_L1, h1);
+  affine_relu(h1, NNUE_L1, net->b2, &net->w2[0][0], NNUE_L2, h2);
+  int32_t v = (net->b3 + dot_u8i8(h2, net->w3, NNUE_L2)) / NNUE_FV_SCALE;
+
+  v = v * 100 / NNUE_PAWN; // centipawns
+  return B->white ? v : -v;
+}
@@ -1,13 +1,27 @@
 #include "lib/opening.h"
 #include "lib/utils.h"
+#include "lib/tt.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
-#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 open_node *root = NULL;
+static _Thread_local uint64_t book_rng; // book_move and the CSV tree, the UI thread
+
+uint64_t book_rand(uint64_t *state) { // xorshift64*
+  if (!*state) *state = ((uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)state) * 0x9e3779b97f4a7c15ULL | 1;
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dULL;
+}
 
 open_node *create_node(const char *move) {
   open_node *node = (open_node *)malloc(sizeof(open_node));
@@ -89,6 +103,7 @@ void init_opening_book() {
 void free_opening_book() {
   free_nodes(root);
   root = NULL;
+  book_close();
 }
 
 int parse_csv_line(FILE *stream, char *buffer, int size) { // 1 on success, 0 on EOF
@@ -135,6 +150,126 @@ int parse_move_string(char *list_str, char **move_array, int max_moves) { // cle
   return count;
 }
 
+typedef struct { // one resolved CSV line
+  char *name; // points into the line buffer
+  char *san[BOOK_MAX_PLY]; // clean SAN moves
+  int codes[BOOK_MAX_PLY]; // from * 64 + to
+  uint64_t keys[BOOK_MAX_PLY]; // book_key before each move
+  int count;
+  int games, w_wins, b_wins;
+} opening_line_t;
+
+uint64_t book_key(board *B) { // execute() does not track castled flags, keep them out of the key
+  uint8_t cc = B->cc;
+  B->cc = 0;
+  uint64_t key = position_key(B);
+  B->cc = cc;
+  return key;
+}
+
+static void free_opening_line(opening_line_t *ol) {
+  for (int i = 0; i < ol->count; ++i)
+    free(ol->san[i]);
+  ol->count = 0;
+}
+
+static int next_opening_line(FILE *file, char *line, int size, opening_line_t *ol) { // 1 resolved, 0 on EOF, -1 skipped
+  if (!parse_csv_line(file, line, size))
+    return 0;
+
+  char *cols[30];
+  int col_idx = 0;
+  char *cursor = line;
+
+  while (*cursor && col_idx < 30) {
+    if (*cursor == '"') {
+      ++cursor;
+      cols[col_idx++] = cursor;
+      while (*cursor && *cursor != '"')
+        ++cursor;
+      *cursor = '\0';
+      ++cursor;
+      if (*cursor == ',')
+        ++cursor;
+    } else {
+      cols[col_idx++] = cursor;
+      while (*cursor && *cursor != ',')
+        ++cursor;
+      if (*cursor == ',') {
+        *cursor = '\0';
+        ++cursor;
+      }
+    }
+  }
+
+  if (col_idx < 24)
+    return -1; // bad line
+
+  ol->name = cols[0];
+  ol->games = atoi(cols[2]);
+  ol->w_wins = atoi(cols[22]);
+  ol->b_wins = atoi(cols[23]);
+
+  char *raw_moves[BOOK_MAX_PLY];
+  int move_count = parse_move_string(cols[10], raw_moves, BOOK_MAX_PLY);
+  if (move_count == 0)
+    return -1;
+
+  for (int i = 0; i < move_count; ++i) { // clean SAN moves
+    char *p = raw_moves[i];
+    char *dot = strchr(p, '.');
+    if (dot) p = dot + 1;  // skip "1."
+    ol->san[i] = strdup(p);
+    free(raw_moves[i]);
+  }
+  ol->count = move_count;
+
+  int valid = 1;
+  board *B = init_board();
+  int side = 1; // 1 = white, 0 = black
+
+  for (int i = 0; i < move_count && valid; ++i) {
+    move_t *moves;
+    int mcount = movegen(B, side, &moves, 1); // legal moves
+    int found = 0;
+
+    for (int j = 0; j < mcount; ++j) {
+      int pt = moves[j].piece;
+      int mf = moves[j].from;
+      int mt = moves[j].to;
+      char tmp[16];
+      uint64_t to_mask = 1ULL << mt;
+      int capture = side ? ((B->blacks & to_mask) != 0) : ((B->whites & to_mask) != 0);
+      san_from_move(pt, mf, mt, capture, tmp, sizeof(tmp));
+      if (strcmp(tmp, ol->san[i]) == 0) {
+        B->white = side;
+        ol->keys[i] = book_key(B);
+        ol->codes[i] = mf * 64 + mt;
+        fast_execute(B, pt, mf, mt, side, 0); // apply move to test board, no promotion in opening
+        side = !side;
+        found = 1;
+        break;
+      }
+    }
+
+    free(moves);
+
+    if (!found) {
+#ifdef DEBUG
+      fprintf(stderr, "Failed to resolve SAN '%s' for opening '%s'; skipping line.\n", ol->san[i], ol->name);
+#endif
+      valid = 0;
+    }
+  }
+
+  free_board(B);
+  if (!valid) {
+    free_opening_line(ol);
+    return -1;
+  }
+  return 1;
+}
+
 int load_openings(const char *filename) {
   FILE *file = fopen(filename, "r");
   if (!file) {
@@ -145,113 +280,260 @@ int load_openings(const char *filename) {
   char line[4096];
   parse_csv_line(file, line, sizeof(line)); // header
   int loaded_count = 0;
+  opening_line_t ol;
+  int r;
 
-  while (parse_csv_line(file, line, sizeof(line))) {
-    char *cols[30];
-    int col_idx = 0;
-    char *cursor = line;
+  while ((r = next_opening_line(file, line, sizeof(line), &ol))) {
+    if (r < 0)
+      continue;
+    add_sequence(ol.san, ol.codes, ol.count, ol.name, ol.w_wins, ol.b_wins);
+    ++loaded_count;
+    free_opening_line(&ol);
+  }
 
-    while (*cursor && col_idx < 30) {
-      if (*cursor == '"') {
-        ++cursor;
-        cols[col_idx++] = cursor;
-        while (*cursor && *cursor != '"')
-          ++cursor;
-        *cursor = '\0';
-        ++cursor;
-        if (*cursor == ',')
-          ++cursor;
-      } else {
-        cols[col_idx++] = cursor;
-        while (*cursor && *cursor != ',')
-          ++cursor;
-        if (*cursor == ',') {
-          *cursor = '\0';
-          ++cursor;
-        }
-      }
-    }
+  fclose(file);
+#ifdef DEBUG
+  printf("Loaded %d openings\n", loaded_count);
+#endif
+  return 1;
+}
 
-    if (col_idx < 11)
-      continue; // bad line
+static int cmp_book_record(const void *a, const void *b) {
+  const book_record_t *x = a, *y = b;
+  if (x->key != y->key) return x->key < y->key ? -1 : 1;
+  return (int)x->move - (int)y->move;
+}
 
-    char *name = cols[0];
-    char *moves_str = cols[10];
-    char *w_wins_str = cols[22];
-    char *b_wins_str = cols[23];
+int book_compile(const char *csv, const char *out) { // every (position, move) of every line, stats summed over lines
+  FILE *file = fopen(csv, "r");
+  if (!file) {
+    perror("failed to open opening book file");
+    return 0;
+  }
+
+  book_record_t *recs = NULL;
+  size_t n = 0, cap = 0;
+  char line[4096];
+  parse_csv_line(file, line, sizeof(line)); // header
+  int lines = 0;
+  opening_line_t ol;
+  int r;
 
-    char *raw_moves[100];
-    int move_count = parse_move_string(moves_str, raw_moves, 100);
-    if (move_count == 0) {
+  while ((r = next_opening_line(file, line, sizeof(line), &ol))) {
+    if (r < 0)
       continue;
+    int draws = ol.games - ol.w_wins - ol.b_wins;
+    if (draws < 0) draws = 0;
+    for (int i = 0; i < ol.count; ++i) {
+      if (n == cap) {
+        cap = cap ? cap * 2 : 4096;
+        recs = realloc(recs, cap * sizeof(book_record_t));
+        if (!recs) {
+          perror("book_compile realloc");
+          exit(1);
+        }
+      }
+      int white = !(i & 1); // mover
+      recs[n++] = (book_record_t){
+        .key = ol.keys[i],
+        .move = tt_encode_move(ol.codes[i] / 64, ol.codes[i] % 64, 0),
+        .wins = (uint32_t)(white ? ol.w_wins : ol.b_wins),
+        .draws = (uint32_t)draws,
+        .losses = (uint32_t)(white ? ol.b_wins : ol.w_wins),
+      };
     }
+    ++lines;
+    free_opening_line(&ol);
+  }
+  fclose(file);
+
+  int ok = book_write(out, recs, n, 1);
+  free(recs);
+  if (ok)
+    printf("Compiled %d lines into %s\n", lines, out);
+  return ok;
+}
 
-    char *san_moves[100]; // clean SAN moves
-    for (int i = 0; i < move_count; ++i) {
-      char *p = raw_moves[i];
-      char *dot = strchr(p, '.');
-      if (dot) p = dot + 1;  // skip "1."
-      san_moves[i] = strdup(p);
+int book_write(const char *out, book_record_t *recs, size_t n, int min_games) { // sorts and merges recs in place
+  qsort(recs, n, sizeof(book_record_t), cmp_book_record);
+  size_t m = 0; // merge transpositions and shared prefixes
+  for (size_t i = 0; i < n; ++i) {
+    if (m && recs[m - 1].key == recs[i].key && recs[m - 1].move == recs[i].move) {
+      recs[m - 1].wins += recs[i].wins;
+      recs[m - 1].draws += recs[i].draws;
+      recs[m - 1].losses += recs[i].losses;
+    } else {
+      recs[m++] = recs[i];
     }
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < m; ++i) // rare moves are noise
+    if ((uint64_t)recs[i].wins + recs[i].draws + recs[i].losses >= (uint64_t)min_games)
+      recs[kept++] = recs[i];
+  m = kept;
+  for (size_t i = 0, j; i < m; i = j) { // games through the move, scaled so the most played move is UINT16_MAX
+    uint64_t most = 1;
+    for (j = i; j < m && recs[j].key == recs[i].key; ++j)
+      if ((uint64_t)recs[j].wins + recs[j].draws + recs[j].losses > most)
+        most = (uint64_t)recs[j].wins + recs[j].draws + recs[j].losses;
+    for (size_t k = i; k < j; ++k) {
+      uint64_t games = (uint64_t)recs[k].wins + recs[k].draws + recs[k].losses;
+      uint64_t w = games * UINT16_MAX / most;
+      recs[k].weight = w ? (uint16_t)w : 1;
+    }
+  }
 
-    int codes[100];
-    int valid = 1;
-
-    board *B = init_board();
-    int side = 1; // 1 = white, 0 = black
-
-    for (int i = 0; i < move_count && valid; ++i) {
-      move_t *moves;
-      int mcount = movegen(B, side, &moves, 1); // legal moves
-      int found = 0;
-
-      for (int j = 0; j < mcount; ++j) {
-        int pt = moves[j].piece;
-        int mf = moves[j].from;
-        int mt = moves[j].to;
-        char tmp[16];
-        uint64_t to_mask = 1ULL << mt;
-        int capture = side ? ((B->blacks & to_mask) != 0) : ((B->whites & to_mask) != 0);
-        san_from_move(pt, mf, mt, capture, tmp, sizeof(tmp));
-        if (strcmp(tmp, san_moves[i]) == 0) {
-          codes[i] = mf * 64 + mt;
-          fast_execute(B, pt, mf, mt, side, 0); // apply move to test board, no promotion in opening
-          side = !side;
-          found = 1;
-          break;
-        }
-      }
+  FILE *f = fopen(out, "wb");
+  if (!f) {
+    perror("failed to write book");
+    return 0;
+  }
+  book_header_t h = { .magic = BOOK_MAGIC, .record_size = sizeof(book_record_t), .count = m };
+  int ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(recs, sizeof(book_record_t), m, f) == m;
+  ok &= fclose(f) == 0;
+  if (!ok) {
+    fprintf(stderr, "Failed to write book %s\n", out);
+    return 0;
+  }
+  printf("Wrote %zu book moves to %s\n", m, out);
+  return 1;
+}
 
-      free(moves);
+static const book_record_t *book_recs = NULL; // mmap, sorted by key then move
+static uint64_t book_count = 0;
+static size_t book_map_size = 0;
+
+int book_open(const char *path) {
+  book_close();
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return 0;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(book_header_t)) {
+    close(fd);
+    return 0;
+  }
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return 0;
+
+  const book_header_t *h = map;
+  if (h->magic != BOOK_MAGIC || h->record_size != sizeof(book_record_t)
+      || h->count > ((size_t)st.st_size - sizeof(book_header_t)) / sizeof(book_record_t)) {
+    fprintf(stderr, "WARNING: book %s has a bad header, ignoring it.\n", path);
+    munmap(map, (size_t)st.st_size);
+    return 0;
+  }
+  book_recs = (const book_record_t *)((const uint8_t *)map + sizeof(book_header_t));
+  book_count = h->count;
+  book_map_size = (size_t)st.st_size;
+  return 1;
+}
 
-      if (!found) {
+void book_close(void) {
+  if (book_recs) munmap((uint8_t *)book_recs - sizeof(book_header_t), book_map_size);
+  book_recs = NULL;
+  book_count = 0;
+  book_map_size = 0;
+}
+
+int book_ready(void) {
+  return book_recs != NULL;
+}
+
+int book_probe(board *B, const book_record_t **out) { // B->white is the side to move
+  if (!book_recs) return 0;
+  uint64_t key = book_key(B);
+  uint64_t lo = 0, hi = book_count;
+  while (lo < hi) { // first record with this key
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (book_recs[mid].key < key) lo = mid + 1;
+    else hi = mid;
+  }
+  uint64_t n = 0;
+  while (lo + n < book_count && book_recs[lo + n].key == key)
+    ++n;
+  *out = book_recs + lo;
+  return (int)n;
+}
+
+int book_init(const char *bin, const char *csv) { // compiled book, else the CSV tree
+  srand(time(NULL));
+  if (book_open(bin)) {
 #ifdef DEBUG
-        fprintf(stderr, "Failed to resolve SAN '%s' for opening '%s'; skipping line.\n", san_moves[i], name);
+    init_opening_book(); // line names
+    load_openings(csv);
 #endif
-        valid = 0;
+    return 1;
+  }
+  fprintf(stderr, "WARNING: no compiled book %s (make book), parsing %s.\n", bin, csv);
+  init_opening_book();
+  return load_openings(csv);
+}
+
+uint64_t book_score(const book_record_t *r) { // popularity times squared expected score, smoothed
+  uint64_t games = (uint64_t)r->wins + r->draws + r->losses;
+  uint64_t perf = 1000 * (2 * (uint64_t)r->wins + r->draws + 1) / (2 * games + 2); // per mille
+  return (uint64_t)r->weight * perf * perf / 1000 + 1;
+}
+
+int book_weights(board *B, const move_t *moves, int count, uint64_t *weights) { // 0 for moves off book, returns games here
+  for (int i = 0; i < count; ++i)
+    weights[i] = 0;
+  const book_record_t *recs;
+  int n = book_probe(B, &recs);
+  int games = 0;
+  for (int i = 0; i < n; ++i) {
+    int from, to, promo;
+    tt_decode_move(recs[i].move, &from, &to, &promo);
+    for (int j = 0; j < count; ++j) {
+      if (moves[j].from == from && moves[j].to == to && moves[j].promo == promo) {
+        weights[j] = book_score(&recs[i]);
+        games += recs[i].wins + recs[i].draws + recs[i].losses;
+        break;
       }
     }
+  }
+  return games;
+}
 
-    free_board(B);
+int book_choose(const uint64_t *weights, int count, uint64_t *rng) { // index drawn by weight, -1 if none
+  uint64_t total = 0;
+  for (int i = 0; i < count; ++i)
+    total += weights[i];
+  if (!total) return -1;
+  uint64_t r = book_rand(rng) % total;
+  int pick = 0;
+  while (r >= weights[pick]) r -= weights[pick++];
+  return pick;
+}
 
-    if (valid) {
-      int w_wins = atoi(w_wins_str);
-      int b_wins = atoi(b_wins_str);
-      add_sequence(san_moves, codes, move_count, name, w_wins, b_wins);
-      ++loaded_count;
-    }
+int book_move(board *B, char **move_history, int history_count) {
+  if (!book_recs) {
+    open_node *book_node = get_book_move(move_history, history_count);
+    return book_node ? book_node->move_code : -1;
+  }
 
-    for (int i = 0; i < move_count; ++i) {
-      free(raw_moves[i]);
-      free(san_moves[i]);
-    }
+  move_t *moves;
+  int mcount = movegen(B, B->white, &moves, 1); // legal moves
+  uint64_t *weights = malloc((mcount ? mcount : 1) * sizeof(uint64_t));
+  if (!weights) {
+    perror("book_move malloc");
+    exit(1);
   }
+  book_weights(B, moves, mcount, weights);
+  int pick = book_choose(weights, mcount, &book_rng);
+  int code = pick < 0 ? -1 : moves[pick].from * 64 + moves[pick].to;
+  free(weights);
+  free(moves);
+  return code;
+}
 
-  fclose(file);
-#ifdef DEBUG
-  printf("Loaded %d openings\n", loaded_count);
-#endif
-  return 1;
+static void node_wins(const open_node *node, int top, int *w_wins, int *b_wins) { // stats sit on line ends, sum the subtree
+  for (; node; node = top ? NULL : node->sibling) {
+    *w_wins += node->white_wins;
+    *b_wins += node->black_wins;
+    node_wins(node->child, 0, w_wins, b_wins);
+  }
 }
 
 open_node *get_book_move(char **move_history, int history_count) {
@@ -273,17 +555,26 @@ open_node *get_book_move(char **move_history, int history_count) {
     if (!found) return NULL; // off the book
   }
 
-  open_node *candidates[50]; // random child
+  open_node *candidates[50]; // weighted by the mover's wins below each child
+  uint64_t weights[50];
+  uint64_t total = 0;
   int count = 0;
+  int white = !(history_count & 1);
   open_node *child = curr->child;
   while (child && count < 50) {
+    int w_wins = 0, b_wins = 0;
+    node_wins(child, 1, &w_wins, &b_wins);
+    weights[count] = 1 + (uint64_t)(white ? w_wins : b_wins);
+    total += weights[count];
     candidates[count++] = child;
     child = child->sibling;
   }
 
   if (count == 0) return NULL; // end of line
 
-  int pick = rand() % count;
+  uint64_t r = book_rand(&book_rng) % total;
+  int pick = 0;
+  while (r >= weights[pick]) r -= weights[pick++];
   return candidates[pick];
 }
 
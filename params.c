@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lib/board.h"
+#include "lib/eval.h"
+#include "lib/params.h"
+
+#ifdef TUNE
+params_t default_params;
+_Thread_local const params_t *params = &default_params;
+#endif
+
+static const char *piece_names[NUM_PIECES] = { "PAWN", "KNIGHT", "BISHOP", "ROOK", "QUEEN", "KING" };
+
+static int piece_index(const char *name) {
+  for (int pt = PAWN; pt <= KING; ++pt)
+    if (!strcmp(name, piece_names[pt])) return pt;
+  return -1;
+}
+
+void params_init(params_t *p) {
+  static const score_t *tables[NUM_PIECES] = { pawn_psqt, knight_psqt, bishop_psqt, rook_psqt, queen_psqt, king_psqt };
+#define X(name, def) p->name = (def);
+  SCORE_PARAMS(X)
+  INT_PARAMS(X)
+#undef X
+  for (int pt = PAWN; pt <= KING; ++pt) {
+    p->piece_value[pt] = piece_value[pt];
+    memcpy(p->pst[pt], tables[pt], sizeof(p->pst[pt]));
+  }
+  params_refresh(p);
+}
+
+void params_refresh(params_t *p) {
+  for (int pt = PAWN; pt <= KING; ++pt) {
+    for (int sq = 0; sq < 64; ++sq) {
+      p->psqt[PCODE(pt, CONST_WHITE)][sq] = p->piece_value[pt] + p->pst[pt][sq];
+      p->psqt[PCODE(pt, CONST_BLACK)][sq] = p->piece_value[pt] + p->pst[pt][FLIP(sq)]; // flip for black
+    }
+  }
+}
+
+int params_set(params_t *p, const char *line) {
+  char name[64];
+  int a, b, c;
+  if (sscanf(line, "%63s", name) != 1) return 0;
+  const char *rest = line + strspn(line, " \t");
+  rest += strlen(name);
+
+#define X(pname, def) \
+  if (!strcmp(name, #pname)) { \
+    if (sscanf(rest, "%d %d", &a, &b) != 2) return 0; \
+    p->pname = S(a, b); \
+    return 1; \
+  }
+  SCORE_PARAMS(X)
+#undef X
+#define X(pname, def) \
+  if (!strcmp(name, #pname)) { \
+    if (sscanf(rest, "%d", &a) != 1) return 0; \
+    p->pname = a; \
+    return 1; \
+  }
+  INT_PARAMS(X)
+#undef X
+
+  if (!strncmp(name, "VALUE_", 6)) {
+    int pt = piece_index(name + 6);
+    if (pt < 0 || sscanf(rest, "%d %d", &a, &b) != 2) return 0;
+    p->piece_value[pt] = S(a, b);
+    return 1;
+  }
+  if (!strncmp(name, "PST_", 4)) {
+    int pt = piece_index(name + 4);
+    if (pt < 0 || sscanf(rest, "%d %d %d", &c, &a, &b) != 3 || c < 0 || c > 63) return 0;
+    p->pst[pt][c] = S(a, b);
+    return 1;
+  }
+  return 0;
+}
+
+int params_load(params_t *p, const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) return 0;
+  char line[256];
+  int n = 0;
+  while (fgets(line, sizeof(line), f)) {
+    ++n;
+    line[strcspn(line, "\r\n#")] = 0; // '#' comments
+    if (!line[strspn(line, " \t")]) continue;
+    if (!params_set(p, line))
+      fprintf(stderr, "WARNING: %s:%d: bad parameter line '%s'\n", path, n, line);
+  }
+  fclose(f);
+  params_refresh(p);
+  return 1;
+}
+
+void params_save(const params_t *p, FILE *f) {
+#define X(name, def) fprintf(f, "%s %d %d\n", #name, mg_score(p->name), eg_score(p->name));
+  SCORE_PARAMS(X)
+#undef X
+#define X(name, def) fprintf(f, "%s %d\n", #name, p->name);
+  INT_PARAMS(X)
+#undef X
+  for (int pt = PAWN; pt <= KING; ++pt)
+    fprintf(f, "VALUE_%s %d %d\n", piece_names[pt], mg_score(p->piece_value[pt]), eg_score(p->piece_value[pt]));
+  for (int pt = PAWN; pt <= KING; ++pt)
+    for (int sq = 0; sq < 64; ++sq)
+      fprintf(f, "PST_%s %d %d %d\n", piece_names[pt], sq, mg_score(p->pst[pt][sq]), eg_score(p->pst[pt][sq]));
+}
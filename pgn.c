@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "lib/board.h"
+#include "lib/opening.h"
+#include "lib/tt.h"
+#include "lib/pgn.h"
+
+typedef struct {
+  char *buf;
+  size_t len;
+} pgn_chunk_t;
+
+static struct { // reader fills, workers drain
+  pgn_chunk_t chunks[PGN_QUEUE_SIZE];
+  int head, count, done;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty, not_full;
+} queue = { .lock = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER };
+
+typedef struct {
+  book_record_t *slots; // open addressing on (key, move), weight 1 marks a used slot
+  size_t size, used;
+  uint64_t games, skipped;
+  const pgn_options_t *opt;
+  board *B;
+  move_t stack[1][MAX_MOVES];
+} pgn_worker_t;
+
+static void queue_push(char *buf, size_t len) {
+  pthread_mutex_lock(&queue.lock);
+  while (queue.count == PGN_QUEUE_SIZE)
+    pthread_cond_wait(&queue.not_full, &queue.lock);
+  queue.chunks[(queue.head + queue.count++) % PGN_QUEUE_SIZE] = (pgn_chunk_t){ buf, len };
+  pthread_cond_signal(&queue.not_empty);
+  pthread_mutex_unlock(&queue.lock);
+}
+
+static int queue_pop(pgn_chunk_t *out) { // 0 once the reader is done and the queue is empty
+  pthread_mutex_lock(&queue.lock);
+  while (!queue.count && !queue.done)
+    pthread_cond_wait(&queue.not_empty, &queue.lock);
+  if (!queue.count) {
+    pthread_mutex_unlock(&queue.lock);
+    return 0;
+  }
+  *out = queue.chunks[queue.head];
+  queue.head = (queue.head + 1) % PGN_QUEUE_SIZE;
+  --queue.count;
+  pthread_cond_signal(&queue.not_full);
+  pthread_mutex_unlock(&queue.lock);
+  return 1;
+}
+
+static void pgn_grow(pgn_worker_t *w) {
+  size_t size = w->size ? w->size * 2 : 1 << 16;
+  book_record_t *slots = calloc(size, sizeof(book_record_t));
+  if (!slots) {
+    perror("pgn_grow calloc");
+    exit(1);
+  }
+  for (size_t i = 0; i < w->size; ++i) {
+    if (!w->slots[i].weight) continue;
+    size_t h = (w->slots[i].key ^ w->slots[i].move * 0x9e3779b97f4a7c15ULL) & (size - 1);
+    while (slots[h].weight) h = (h + 1) & (size - 1);
+    slots[h] = w->slots[i];
+  }
+  free(w->slots);
+  w->slots = slots;
+  w->size = size;
+}
+
+static void pgn_add(pgn_worker_t *w, uint64_t key, uint16_t move, int result) { // result for the mover: 1, 0, -1
+  if (2 * (w->used + 1) > w->size) pgn_grow(w);
+  size_t mask = w->size - 1;
+  size_t h = (key ^ move * 0x9e3779b97f4a7c15ULL) & mask;
+  while (w->slots[h].weight && (w->slots[h].key != key || w->slots[h].move != move))
+    h = (h + 1) & mask;
+  book_record_t *r = &w->slots[h];
+  if (!r->weight) {
+    *r = (book_record_t){ .key = key, .move = move, .weight = 1 };
+    ++w->used;
+  }
+  if (result > 0) ++r->wins;
+  else if (result < 0) ++r->losses;
+  else ++r->draws;
+}
+
+static int pgn_result(const char *s, size_t n) { // 1 white, 0 draw, -1 black, 2 unknown
+  if (n >= 3 && !strncmp(s, "1-0", 3)) return 1;
+  if (n >= 3 && !strncmp(s, "0-1", 3)) return -1;
+  if (n >= 7 && !strncmp(s, "1/2-1/2", 7)) return 0;
+  return 2;
+}
+
+static int san_legal(board *B, const move_t *m) {
+  undo_t u;
+  int white = B->white;
+  make_move(B, m, white, &u);
+  int legal = !check(B, !white);
+  unmake_move(B, m, white, &u);
+  return legal;
+}
+
+int parse_san(board *B, const char *san, const move_t *moves, int count, move_t *out) {
+  char s[16];
+  int len = 0;
+  for (const char *p = san; *p && len < 15; ++p) // drop capture, promotion, check and annotation marks
+    if (!strchr("x=+#!?-", *p)) s[len++] = *p;
+  s[len] = '\0';
+
+  if (!strcmp(s, "OO") || !strcmp(s, "00") || !strcmp(s, "OOO") || !strcmp(s, "000")) {
+    int step = len == 2 ? 2 : -2;
+    for (int i = 0; i < count; ++i) {
+      if (moves[i].piece == KING && moves[i].to - moves[i].from == step && san_legal(B, &moves[i])) {
+        *out = moves[i];
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  static const char *letters = "PNBRQK";
+  int piece = PAWN, idx = 0;
+  if (len && s[0] != 'P' && strchr(letters + 1, s[0])) {
+    piece = (int)(strchr(letters, s[0]) - letters);
+    idx = 1;
+  }
+  int promo = 0;
+  if (piece == PAWN && len > idx && strchr("NBRQ", s[len - 1])) {
+    promo = (int)(strchr(letters, s[len - 1]) - letters);
+    --len;
+  }
+  if (len - idx < 2 || s[len - 2] < 'a' || s[len - 2] > 'h' || s[len - 1] < '1' || s[len - 1] > '8')
+    return 0;
+  int to = (s[len - 1] - '1') * 8 + (s[len - 2] - 'a');
+
+  int from_file = -1, from_rank = -1; // disambiguation
+  for (int i = idx; i < len - 2; ++i) {
+    if (s[i] >= 'a' && s[i] <= 'h') from_file = s[i] - 'a';
+    else if (s[i] >= '1' && s[i] <= '8') from_rank = s[i] - '1';
+    else return 0;
+  }
+
+  int found = 0;
+  for (int i = 0; i < count; ++i) {
+    const move_t *m = &moves[i];
+    if (m->piece != piece || m->to != to) continue;
+    if (from_file >= 0 && m->from % 8 != from_file) continue;
+    if (from_rank >= 0 && m->from / 8 != from_rank) continue;
+    if (m->promo != (promo ? promo : (m->promo ? QUEEN : 0))) continue; // bare promotion means queen
+    if (piece == KING && abs(m->to - m->from) == 2 && m->from / 8 == m->to / 8) continue; // castles are O-O
+    if (!san_legal(B, m)) continue; // only legal moves count for disambiguation
+    *out = *m;
+    ++found;
+  }
+  return found == 1;
+}
+
+static void pgn_game(pgn_worker_t *w, const char *fen, int result, const char *p, const char *end) { // replay movetext
+  board *B = w->B;
+  if (!load_fen(B, *fen ? fen : PGN_START_FEN)) {
+    ++w->skipped;
+    return;
+  }
+  uint64_t keys[256];
+  uint16_t codes[256];
+  int whites[256];
+  int ply = 0, replaying = 1, depth = 0;
+
+  while (p < end) {
+    if (isspace((unsigned char)*p)) {
+      ++p;
+      continue;
+    }
+    if (*p == '{') { // comment
+      while (p < end && *p != '}') ++p;
+      ++p;
+      continue;
+    }
+    if (*p == ';') { // rest of line comment
+      while (p < end && *p != '\n') ++p;
+      continue;
+    }
+    if (*p == '(' || *p == ')') { // variations
+      depth += *p == '(' ? 1 : -1;
+      ++p;
+      continue;
+    }
+    const char *t = p;
+    while (p < end && !isspace((unsigned char)*p) && !strchr("{;()", *p)) ++p;
+    if (depth > 0 || *t == '$') continue; // NAG
+    if (*t == '*' || pgn_result(t, p - t) != 2) {
+      if (result == 2) result = pgn_result(t, p - t);
+      break;
+    }
+    while (t < p && isdigit((unsigned char)*t)) ++t; // move number, "12." or "12...e5"
+    while (t < p && *t == '.') ++t;
+    if (t == p || !replaying) continue;
+    if (ply >= w->opt->max_ply || ply >= 256) {
+      replaying = 0;
+      continue;
+    }
+
+    char san[16];
+    size_t n = (size_t)(p - t) < sizeof(san) - 1 ? (size_t)(p - t) : sizeof(san) - 1;
+    memcpy(san, t, n);
+    san[n] = '\0';
+    move_t *moves, m;
+    int count = movegen_ply(B, B->white, 0, 0, &moves, w->stack, MAX_MOVES, NULL); // legality checked on the match only
+    if (!parse_san(B, san, moves, count, &m)) { // en passant is not generated, keep the plies so far
+      replaying = 0;
+      continue;
+    }
+    keys[ply] = book_key(B);
+    codes[ply] = tt_encode_move(m.from, m.to, m.promo);
+    whites[ply] = B->white;
+    ++ply;
+    undo_t u;
+    make_move(B, &m, B->white, &u);
+    B->white = !B->white;
+  }
+
+  if (result == 2 || !ply) {
+    ++w->skipped;
+    return;
+  }
+  for (int i = 0; i < ply; ++i)
+    pgn_add(w, keys[i], codes[i], whites[i] ? result : -result);
+  ++w->games;
+}
+
+static void pgn_chunk(pgn_worker_t *w, const char *p, const char *end) { // whole games only
+  char fen[128] = "";
+  int result = 2;
+  const char *moves = NULL, *moves_end = NULL;
+
+  while (p < end) {
+    const char *eol = memchr(p, '\n', end - p);
+    if (!eol) eol = end;
+    if (*p == '[') {
+      if (moves) { // tags after movetext start the next game
+        pgn_game(w, fen, result, moves, moves_end);
+        fen[0] = '\0';
+        result = 2;
+        moves = NULL;
+      }
+      const char *q = memchr(p, '"', eol - p);
+      const char *r = q ? memchr(q + 1, '"', eol - q - 1) : NULL;
+      if (q && r) {
+        if (!strncmp(p, "[Result ", 8)) result = pgn_result(q + 1, r - q - 1);
+        else if (!strncmp(p, "[FEN ", 5) && (size_t)(r - q - 1) < sizeof(fen)) {
+          memcpy(fen, q + 1, r - q - 1);
+          fen[r - q - 1] = '\0';
+        }
+      }
+    } else {
+      const char *s = p;
+      while (s < eol && isspace((unsigned char)*s)) ++s;
+      if (s < eol) {
+        if (!moves) moves = p;
+        moves_end = eol;
+      }
+    }
+    p = eol + 1;
+  }
+  if (moves) pgn_game(w, fen, result, moves, moves_end);
+}
+
+static void *pgn_worker(void *arg) {
+  pgn_worker_t *w = arg;
+  pgn_chunk_t c;
+  while (queue_pop(&c)) {
+    pgn_chunk(w, c.buf, c.buf + c.len);
+    free(c.buf);
+  }
+  return NULL;
+}
+
+static size_t pgn_cut(const char *buf, size_t len) { // start of the last game, a tag line after a blank line, 0 if none
+  for (size_t i = len; i-- > 1;) {
+    if (buf[i] != '[' || buf[i - 1] != '\n') continue;
+    size_t j = i - 1;
+    while (j > 0 && (buf[j - 1] == ' ' || buf[j - 1] == '\t' || buf[j - 1] == '\r')) --j;
+    if (j == 0 || buf[j - 1] == '\n') return i;
+  }
+  return 0;
+}
+
+int pgn_build_book(const char *pgn, const char *out, const pgn_options_t *opt) {
+  FILE *f = fopen(pgn, "rb");
+  if (!f) {
+    perror("failed to open PGN file");
+    return 0;
+  }
+  int threads = opt->threads > 0 ? opt->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1) threads = 1;
+  if (threads > PGN_MAX_THREADS) threads = PGN_MAX_THREADS;
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  queue.head = queue.count = queue.done = 0;
+  pgn_worker_t *workers = calloc(threads, sizeof(pgn_worker_t));
+  pthread_t tids[PGN_MAX_THREADS];
+  for (int i = 0; i < threads; ++i) {
+    workers[i].opt = opt;
+    workers[i].B = init_board();
+    pthread_create(&tids[i], NULL, pgn_worker, &workers[i]);
+  }
+
+  char *buf = NULL; // carry holds the unfinished last game of the previous read
+  size_t carry = 0;
+  uint64_t bytes = 0;
+  for (;;) {
+    char *next = malloc(carry + PGN_CHUNK_SIZE);
+    if (!next) {
+      perror("pgn_build_book malloc");
+      exit(1);
+    }
+    if (carry) memcpy(next, buf, carry);
+    free(buf);
+    buf = next;
+    size_t n = fread(buf + carry, 1, PGN_CHUNK_SIZE, f);
+    size_t len = carry + n;
+    bytes += n;
+    if (!n) {
+      if (len) queue_push(buf, len);
+      else free(buf);
+      buf = NULL;
+      break;
+    }
+    size_t cut = pgn_cut(buf, len);
+    if (!cut) { // one game longer than the read so far
+      carry = len;
+      continue;
+    }
+    carry = len - cut;
+    char *rest = malloc(carry ? carry : 1);
+    if (!rest) {
+      perror("pgn_build_book malloc");
+      exit(1);
+    }
+    memcpy(rest, buf + cut, carry);
+    queue_push(buf, cut);
+    buf = rest;
+  }
+  fclose(f);
+
+  pthread_mutex_lock(&queue.lock);
+  queue.done = 1;
+  pthread_cond_broadcast(&queue.not_empty);
+  pthread_mutex_unlock(&queue.lock);
+
+  uint64_t games = 0, skipped = 0;
+  size_t total = 0;
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(tids[i], NULL);
+    games += workers[i].games;
+    skipped += workers[i].skipped;
+    total += workers[i].used;
+  }
+
+  book_record_t *recs = malloc((total ? total : 1) * sizeof(book_record_t));
+  if (!recs) {
+    perror("pgn_build_book malloc");
+    exit(1);
+  }
+  size_t n = 0;
+  for (int i = 0; i < threads; ++i) {
+    for (size_t j = 0; j < workers[i].size; ++j)
+      if (workers[i].slots[j].weight) recs[n++] = workers[i].slots[j];
+    free(workers[i].slots);
+    free_board(workers[i].B);
+  }
+  free(workers);
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  printf("Parsed %llu games (%llu skipped, %.1f MB) on %d threads in %.2fs\n",
+         (unsigned long long)games, (unsigned long long)skipped, bytes / 1048576.0, threads, secs);
+  int ok = book_write(out, recs, n, opt->min_games);
+  free(recs);
+  return ok;
+}
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "lib/board.h"
+#include "lib/bot.h"
+#include "lib/eval.h"
+#include "lib/magic.h"
+#include "lib/manager.h"
+#include "lib/opening.h"
+#include "lib/params.h"
+#include "lib/tt.h"
+#include "lib/match.h"
+#include "lib/spsa.h"
+
+#ifdef TUNE
+#define P(name, lo, hi, c) { #name, offsetof(params_t, name), lo, hi, c }
+static const spsa_param_t spsa_params[] = { // search margins and reductions from params.h
+  P(NMP_BASE_REDUCTION, 1, 5, 0.5),
+  P(NMP_MARGIN, 0, 600, 20),
+  P(LMR_BASE_REDUCTION, 0, 3, 0.5),
+  P(LMP_SKIP_BASE, 1, 12, 1),
+  P(RAZOR_MARGIN1, 0, 800, 20),
+  P(RAZOR_MARGIN2, 0, 1200, 30),
+  P(SEE_PRUNE_MARGIN, 0, 400, 10),
+  P(SE_MARGIN, 0, 16, 1),
+  P(RFP_MARGIN, 10, 300, 8),
+  P(HIST_PRUNE_MARGIN, 0, 16000, 400),
+  P(PROBCUT_MARGIN, 50, 600, 15),
+  P(DELTA_MARGIN, 0, 600, 15),
+#if FUT_ENABLED // no effect while futility is compiled out
+  P(FUT_BASE_MARGIN, 0, 800, 20),
+  P(FUT_MOVE_MARGIN, 0, 600, 15),
+#endif
+};
+#undef P
+#define SPSA_COUNT ((int)(sizeof(spsa_params) / sizeof(spsa_params[0])))
+
+static struct {
+  match_engine_t engine; // both sides start from this, params is the base set
+  double theta[SPSA_COUNT];
+  double a[SPSA_COUNT]; // step numerators, fixed by SPSA_R_END
+  double A; // stability constant, a tenth of the run
+  int iterations, next, done, checkpoint, book_plies;
+  int plus, minus; // game points of the + and - sides
+  const char *out;
+  pthread_mutex_t lock;
+} spsa = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int spsa_clamp(const spsa_param_t *sp, double v) {
+  long r = lround(v);
+  return r < sp->min ? sp->min : r > sp->max ? sp->max : (int)r;
+}
+
+static void spsa_set(params_t *p, const spsa_param_t *sp, int v) {
+  *(int *)((char *)p + sp->offset) = v;
+}
+
+static void spsa_save(void) { // caller holds the lock
+  params_t p = spsa.engine.params;
+  for (int i = 0; i < SPSA_COUNT; ++i)
+    spsa_set(&p, &spsa_params[i], spsa_clamp(&spsa_params[i], spsa.theta[i]));
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", spsa.out); // renamed over the old file, a crash never leaves half a checkpoint
+  FILE *f = fopen(tmp, "w");
+  if (!f) {
+    perror("failed to open spsa output");
+    exit(1);
+  }
+  fprintf(f, "# spsa iteration %d/%d\n", spsa.done, spsa.iterations);
+  fprintf(f, "# spsa state %d %d %d %d\n", spsa.done, spsa.iterations, spsa.plus, spsa.minus); // read back by --resume
+  for (int i = 0; i < SPSA_COUNT; ++i)
+    fprintf(f, "# spsa theta %s %.17g\n", spsa_params[i].name, spsa.theta[i]);
+  params_save(&p, f);
+  if (fclose(f) || rename(tmp, spsa.out)) {
+    perror("failed to write spsa output");
+    exit(1);
+  }
+
+  printf("Iteration %d/%d, + %d - %d:", spsa.done, spsa.iterations, spsa.plus, spsa.minus);
+  for (int i = 0; i < SPSA_COUNT; ++i)
+    printf(" %s %.2f", spsa_params[i].name, spsa.theta[i]);
+  printf("\n");
+  fflush(stdout);
+}
+
+static void *spsa_worker(void *arg) { // asynchronous, each pair is applied as soon as it finishes
+  (void)arg;
+  uint64_t rng = 0; // seeded on first use, per worker, drives the flips and the openings
+  for (;;) {
+    double theta[SPSA_COUNT];
+    pthread_mutex_lock(&spsa.lock);
+    int k = spsa.next < spsa.iterations ? ++spsa.next : 0;
+    memcpy(theta, spsa.theta, sizeof(theta));
+    pthread_mutex_unlock(&spsa.lock);
+    if (!k) break;
+
+    match_engine_t engine[2] = { spsa.engine, spsa.engine }; // theta + c delta, theta - c delta
+    int flip[SPSA_COUNT];
+    double c[SPSA_COUNT];
+    for (int i = 0; i < SPSA_COUNT; ++i) {
+      const spsa_param_t *sp = &spsa_params[i];
+      flip[i] = book_rand(&rng) & 1 ? 1 : -1;
+      c[i] = sp->c_end * pow((double)spsa.iterations / k, SPSA_GAMMA);
+      spsa_set(&engine[0].params, sp, spsa_clamp(sp, theta[i] + c[i] * flip[i]));
+      spsa_set(&engine[1].params, sp, spsa_clamp(sp, theta[i] - c[i] * flip[i]));
+    }
+    move_t opening[MATCH_MAX_OPENING];
+    int len = match_opening(opening, spsa.book_plies, &rng);
+    int r = match_play(engine, opening, len, 1) + match_play(engine, opening, len, 0); // -2 to 2 for the + side
+
+    pthread_mutex_lock(&spsa.lock);
+    for (int i = 0; i < SPSA_COUNT; ++i) {
+      const spsa_param_t *sp = &spsa_params[i];
+      double ak = spsa.a[i] / pow(spsa.A + k, SPSA_ALPHA);
+      spsa.theta[i] += ak / c[i] * r * flip[i];
+      if (spsa.theta[i] < sp->min) spsa.theta[i] = sp->min;
+      if (spsa.theta[i] > sp->max) spsa.theta[i] = sp->max;
+    }
+    spsa.plus += 2 + r;
+    spsa.minus += 2 - r;
+    ++spsa.done;
+    if (spsa.done % spsa.checkpoint == 0 || spsa.done == spsa.iterations) spsa_save();
+    pthread_mutex_unlock(&spsa.lock);
+  }
+  match_thread_free();
+  return NULL;
+}
+static int spsa_resume(const char *path, int *iterations) { // state lines of a checkpoint, the params themselves go through params_load
+  FILE *f = fopen(path, "r");
+  if (!f) return 0;
+  char line[256], name[64];
+  int found = 0;
+  while (fgets(line, sizeof(line), f)) {
+    double v;
+    if (sscanf(line, "# spsa state %d %d %d %d", &spsa.done, iterations, &spsa.plus, &spsa.minus) == 4) {
+      found = 1;
+    } else if (sscanf(line, "# spsa theta %63s %lf", name, &v) == 2) {
+      for (int i = 0; i < SPSA_COUNT; ++i)
+        if (!strcmp(spsa_params[i].name, name)) spsa.theta[i] = v;
+    }
+  }
+  fclose(f);
+  return found;
+}
+
+int spsa_main(int argc, char **argv) {
+  if (argc < 1) {
+    fprintf(stderr, "Usage: ./a.out spsa <out> [--iterations n] [--concurrency n] [--nodes n] [--depth d] [--time s] [--book-plies n] [--hash mb] [--params start] [--resume checkpoint] [--checkpoint n]\n");
+    return 1;
+  }
+  init_attack_tables();
+  init_pesto_tables();
+  spsa.engine = (match_engine_t){ .depth = SPSA_DEPTH, .nodes = SPSA_NODES, .limit = 10, .params = default_params };
+  spsa.iterations = SPSA_ITERATIONS;
+  spsa.checkpoint = SPSA_CHECKPOINT;
+  spsa.book_plies = SPSA_BOOK_PLIES;
+  spsa.out = argv[0];
+  int threads = 0, iterations = 0;
+  const char *resume = NULL;
+  tt_size_mb = SPSA_HASH_MB;
+
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Missing value for %s\n", argv[i]);
+      return 1;
+    }
+    if (!strcmp(argv[i], "--iterations")) iterations = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--concurrency")) threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--nodes")) spsa.engine.nodes = atol(argv[++i]);
+    else if (!strcmp(argv[i], "--depth")) spsa.engine.depth = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--time")) spsa.engine.limit = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--book-plies")) spsa.book_plies = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--hash")) tt_size_mb = (size_t)atol(argv[++i]);
+    else if (!strcmp(argv[i], "--checkpoint")) spsa.checkpoint = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--params") || !strcmp(argv[i], "--resume")) {
+      if (!strcmp(argv[i], "--resume")) resume = argv[i + 1];
+      if (!params_load(&spsa.engine.params, argv[++i])) {
+        fprintf(stderr, "Failed to load parameters: %s\n", argv[i]);
+        return 1;
+      }
+    } else {
+      fprintf(stderr, "Unknown spsa option: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  for (int i = 0; i < SPSA_COUNT; ++i) // resumed values replace these below
+    spsa.theta[i] = *(const int *)((const char *)&spsa.engine.params + spsa_params[i].offset);
+  if (resume && !spsa_resume(resume, &spsa.iterations)) {
+    fprintf(stderr, "No spsa state in %s\n", resume);
+    return 1;
+  }
+  if (iterations) spsa.iterations = iterations; // overrides a resumed run's length, which also reshapes its schedule
+  spsa.next = spsa.done; // k carries on from the checkpoint, so steps and perturbations stay where they were
+  if (spsa.done >= spsa.iterations && resume) {
+    fprintf(stderr, "%s already finished %d iterations, raise --iterations to go on.\n", resume, spsa.done);
+    return 1;
+  }
+  if (spsa.iterations < 1 || spsa.checkpoint < 1 || spsa.engine.depth < 1 || !tt_size_mb) {
+    fprintf(stderr, "Bad spsa options.\n");
+    return 1;
+  }
+  if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1) threads = 1;
+  if (threads > MATCH_MAX_THREADS) threads = MATCH_MAX_THREADS;
+
+  spsa.A = 0.1 * spsa.iterations;
+  for (int i = 0; i < SPSA_COUNT; ++i) {
+    const spsa_param_t *sp = &spsa_params[i];
+    spsa.a[i] = SPSA_R_END * sp->c_end * sp->c_end * pow(spsa.A + spsa.iterations, SPSA_ALPHA);
+  }
+  if (!book_open(BOOK_FILE))
+    fprintf(stderr, "WARNING: no %s, openings are random legal moves.\n", BOOK_FILE);
+  printf("SPSA: %d parameters, %d game pairs on %d threads, depth %d nodes %ld\n", SPSA_COUNT, spsa.iterations, threads,
+         spsa.engine.depth, spsa.engine.nodes);
+  if (resume) printf("Resuming %s at iteration %d, + %d - %d\n", resume, spsa.done, spsa.plus, spsa.minus);
+
+  pthread_t tids[MATCH_MAX_THREADS];
+  for (int t = 0; t < threads; ++t)
+    pthread_create(&tids[t], NULL, spsa_worker, NULL);
+  for (int t = 0; t < threads; ++t)
+    pthread_join(tids[t], NULL);
+
+  printf("Final values (%s):\n", spsa.out);
+  for (int i = 0; i < SPSA_COUNT; ++i)
+    printf("%s %d\n", spsa_params[i].name, spsa_clamp(&spsa_params[i], spsa.theta[i]));
+  book_close();
+  return 0;
+}
+#else
+int spsa_main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  fprintf(stderr, "Parameters are compiled in, rebuild with make tune.\n");
+  return 1;
+}
+#endif
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lib/board.h"
+#include "lib/bot.h"
+#include "lib/eval.h"
+#include "lib/magic.h"
+#include "lib/params.h"
+#include "lib/datagen.h"
+#include "lib/texel.h"
+
+enum { // weight layout, each with an mg and an eg half
+#define X(name, def) TW_##name,
+  SCORE_PARAMS(X)
+#undef X
+  TW_VALUE,
+  TW_PST = TW_VALUE + NUM_PIECES,
+  TW_COUNT = TW_PST + NUM_PIECES * 64
+};
+
+typedef struct { // one thread's slice of the data, loaded and evaluated by that thread
+  const char *begin, *end;
+  int packed;
+  texel_entry_t *pos;
+  texel_coeff_t *coeffs;
+  size_t n, cap, ncoeff, ccap, skipped;
+  int want_grad;
+  double loss;
+  double grad[TW_COUNT][2];
+} texel_shard_t;
+
+static double weights[TW_COUNT][2];
+static double K;
+static int tempo;
+
+static int parse_result(const char *line, float *r) { // "1-0", "1/2-1/2", "0-1" or "[1.0]" anywhere after the FEN
+  if (strstr(line, "1/2-1/2")) *r = 0.5f;
+  else if (strstr(line, "1-0")) *r = 1.0f;
+  else if (strstr(line, "0-1")) *r = 0.0f;
+  else {
+    const char *b = strrchr(line, '[');
+    if (!b) return 0;
+    *r = strtof(b + 1, NULL);
+  }
+  return *r >= 0 && *r <= 1;
+}
+
+static void texel_add(texel_shard_t *sh, const board *B, float result) { // features once, so epochs need no board work
+  int dense[TW_COUNT] = { 0 };
+  attack_info_t ai;
+  compute_attacks(B, &ai);
+  dense[TW_MOBILITY_W] = mobility(B, &ai); // same terms as blended_eval
+  dense[TW_CENTER_W] = center_control(B);
+  dense[TW_KING_SAFETY_W] = king_safe(B, &ai);
+  dense[TW_KING_ACTIVITY_W] = king_activity(B);
+  dense[TW_PSTRUCT_W] = pawn_structure(B);
+  dense[TW_PASSED_W] = passed_pawns(B);
+  dense[TW_DEV_W] = development(B);
+  dense[TW_CASTLE_W] = castle_eval(B);
+  for (int pt = PAWN; pt <= KING; ++pt) {
+    for (uint64_t bb = B->WHITE[pt]; bb; bb &= bb - 1) {
+      ++dense[TW_VALUE + pt];
+      ++dense[TW_PST + pt * 64 + __builtin_ctzll(bb)];
+    }
+    for (uint64_t bb = B->BLACK[pt]; bb; bb &= bb - 1) { // black reads the flipped square
+      --dense[TW_VALUE + pt];
+      --dense[TW_PST + pt * 64 + FLIP(__builtin_ctzll(bb))];
+    }
+  }
+
+  if (sh->n == sh->cap) {
+    sh->cap = sh->cap ? sh->cap * 2 : 4096;
+    sh->pos = realloc(sh->pos, sh->cap * sizeof(texel_entry_t));
+  }
+  if (sh->ncoeff + TW_COUNT > sh->ccap) {
+    sh->ccap = sh->ccap ? sh->ccap * 2 : 4096 * 48;
+    sh->coeffs = realloc(sh->coeffs, sh->ccap * sizeof(texel_coeff_t));
+  }
+  if (!sh->pos || !sh->coeffs) {
+    perror("texel_add realloc");
+    exit(1);
+  }
+  texel_entry_t *e = &sh->pos[sh->n++];
+  int p24;
+  pesto_terms(B, &p24);
+  e->start = (uint32_t)sh->ncoeff;
+  e->phase = (uint8_t)p24;
+  e->scale = (uint8_t)scale(B, 0);
+  e->white = (uint8_t)(B->white != 0);
+  e->result = result;
+  int count = 0;
+  for (int i = 0; i < TW_COUNT; ++i) {
+    if (!dense[i]) continue;
+    sh->coeffs[sh->ncoeff++] = (texel_coeff_t){ (uint16_t)i, (int16_t)dense[i] };
+    ++count;
+  }
+  e->count = (uint8_t)count;
+}
+
+static void *texel_load(void *arg) {
+  texel_shard_t *sh = arg;
+  board *B = init_board();
+  if (sh->packed) {
+    for (const packed_pos_t *p = (const packed_pos_t *)sh->begin; p < (const packed_pos_t *)sh->end; ++p) {
+      if (!unpack_position(p, B)) {
+        ++sh->skipped;
+        continue;
+      }
+      texel_add(sh, B, (p->result + 1) / 2.0f);
+    }
+  } else {
+    char line[TEXEL_MAX_LINE];
+    for (const char *s = sh->begin; s < sh->end;) {
+      const char *nl = memchr(s, '\n', sh->end - s);
+      size_t len = (nl ? nl : sh->end) - s;
+      if (len >= sizeof(line)) len = sizeof(line) - 1;
+      memcpy(line, s, len);
+      line[len] = 0;
+      s = nl ? nl + 1 : sh->end;
+      float r;
+      if (!line[strspn(line, " \t\r")]) continue;
+      if (!parse_result(line, &r) || !load_fen(B, line)) {
+        ++sh->skipped;
+        continue;
+      }
+      texel_add(sh, B, r);
+    }
+  }
+  free_board(B);
+  return NULL;
+}
+
+static void *texel_pass(void *arg) { // loss, and the unscaled gradient when asked
+  texel_shard_t *sh = arg;
+  sh->loss = 0;
+  if (sh->want_grad) memset(sh->grad, 0, sizeof(sh->grad));
+  for (size_t i = 0; i < sh->n; ++i) {
+    const texel_entry_t *e = &sh->pos[i];
+    const texel_coeff_t *c = &sh->coeffs[e->start];
+    double mg = 0, eg = 0;
+    for (int k = 0; k < e->count; ++k) {
+      mg += c[k].coeff * weights[c[k].index][0];
+      eg += c[k].coeff * weights[c[k].index][1];
+    }
+    double wm = e->phase / 24.0, we = (24 - e->phase) / 24.0 * e->scale / 64.0;
+    double score = mg * wm + eg * we + (e->white ? tempo : -tempo);
+    double sig = 1 / (1 + exp(-K * score));
+    double err = sig - e->result;
+    sh->loss += err * err;
+    if (!sh->want_grad) continue;
+    double d = err * sig * (1 - sig);
+    for (int k = 0; k < e->count; ++k) {
+      sh->grad[c[k].index][0] += d * wm * c[k].coeff;
+      sh->grad[c[k].index][1] += d * we * c[k].coeff;
+    }
+  }
+  return NULL;
+}
+
+static double texel_run(texel_shard_t *shards, int n, size_t total, int want_grad, double grad[TW_COUNT][2]) { // mean squared error
+  pthread_t tids[TEXEL_MAX_THREADS];
+  for (int t = 0; t < n; ++t) {
+    shards[t].want_grad = want_grad;
+    pthread_create(&tids[t], NULL, texel_pass, &shards[t]);
+  }
+  double loss = 0;
+  if (want_grad) memset(grad, 0, sizeof(double) * TW_COUNT * 2);
+  for (int t = 0; t < n; ++t) {
+    pthread_join(tids[t], NULL);
+    loss += shards[t].loss;
+    if (!want_grad) continue;
+    for (int i = 0; i < TW_COUNT; ++i) {
+      grad[i][0] += shards[t].grad[i][0];
+      grad[i][1] += shards[t].grad[i][1];
+    }
+  }
+  return loss / total;
+}
+
+static void texel_fit_k(texel_shard_t *shards, int n, size_t total) { // golden section on the starting weights
+  double lo = 0, hi = 0.02, g = (sqrt(5) - 1) / 2;
+  for (int i = 0; i < 40; ++i) {
+    double a = hi - g * (hi - lo), b = lo + g * (hi - lo);
+    K = a;
+    double la = texel_run(shards, n, total, 0, NULL);
+    K = b;
+    double lb = texel_run(shards, n, total, 0, NULL);
+    if (la < lb) hi = b;
+    else lo = a;
+  }
+  K = (lo + hi) / 2;
+}
+
+static int texel_save(const params_t *start, const char *out) {
+  params_t p = *start;
+#define X(name, def) p.name = S((int)lround(weights[TW_##name][0]), (int)lround(weights[TW_##name][1]));
+  SCORE_PARAMS(X)
+#undef X
+  for (int pt = PAWN; pt <= KING; ++pt) {
+    p.piece_value[pt] = S((int)lround(weights[TW_VALUE + pt][0]), (int)lround(weights[TW_VALUE + pt][1]));
+    for (int sq = 0; sq < 64; ++sq)
+      p.pst[pt][sq] = S((int)lround(weights[TW_PST + pt * 64 + sq][0]), (int)lround(weights[TW_PST + pt * 64 + sq][1]));
+  }
+  params_refresh(&p);
+  FILE *f = fopen(out, "w");
+  if (!f) {
+    perror("failed to open parameter output");
+    return 0;
+  }
+  params_save(&p, f);
+  return fclose(f) == 0;
+}
+
+int texel_tune(const char *data, const char *out, const texel_options_t *opt) {
+  params_t start;
+  params_init(&start);
+  if (opt->start && !params_load(&start, opt->start)) {
+    fprintf(stderr, "Failed to load parameters: %s\n", opt->start);
+    return 0;
+  }
+#define X(name, def) weights[TW_##name][0] = mg_score(start.name), weights[TW_##name][1] = eg_score(start.name);
+  SCORE_PARAMS(X)
+#undef X
+  for (int pt = PAWN; pt <= KING; ++pt) {
+    weights[TW_VALUE + pt][0] = mg_score(start.piece_value[pt]);
+    weights[TW_VALUE + pt][1] = eg_score(start.piece_value[pt]);
+    for (int sq = 0; sq < 64; ++sq) {
+      weights[TW_PST + pt * 64 + sq][0] = mg_score(start.pst[pt][sq]);
+      weights[TW_PST + pt * 64 + sq][1] = eg_score(start.pst[pt][sq]);
+    }
+  }
+  tempo = start.TEMPO_BONUS;
+
+  int fd = open(data, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+    fprintf(stderr, "Failed to open %s\n", data);
+    if (fd >= 0) close(fd);
+    return 0;
+  }
+  size_t size = (size_t)st.st_size;
+  const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("texel mmap");
+    return 0;
+  }
+  madvise((void *)map, size, MADV_SEQUENTIAL);
+
+  int n = opt->threads > 0 ? opt->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1) n = 1;
+  if (n > TEXEL_MAX_THREADS) n = TEXEL_MAX_THREADS;
+  size_t len = strlen(data);
+  int packed = len > 4 && !strcmp(data + len - 4, ".bin");
+  if (packed) size -= size % sizeof(packed_pos_t);
+  texel_shard_t *shards = calloc(n, sizeof(texel_shard_t));
+  if (!shards) {
+    perror("texel_tune calloc");
+    exit(1);
+  }
+  const char *cut = map;
+  for (int t = 0; t < n; ++t) { // split on record or line boundaries
+    shards[t].packed = packed;
+    shards[t].begin = cut;
+    if (packed) {
+      size_t records = size / sizeof(packed_pos_t);
+      cut = map + records * (t + 1) / n * sizeof(packed_pos_t);
+    } else {
+      cut = map + size * (t + 1) / n;
+      if (cut < shards[t].begin) cut = shards[t].begin;
+      const char *nl = t < n - 1 ? memchr(cut, '\n', map + size - cut) : NULL;
+      cut = nl ? nl + 1 : map + size;
+    }
+    shards[t].end = cut;
+  }
+
+  double t0 = gtime();
+  pthread_t tids[TEXEL_MAX_THREADS];
+  for (int t = 0; t < n; ++t)
+    pthread_create(&tids[t], NULL, texel_load, &shards[t]);
+  size_t total = 0, coeffs = 0, skipped = 0;
+  for (int t = 0; t < n; ++t) {
+    pthread_join(tids[t], NULL);
+    total += shards[t].n;
+    coeffs += shards[t].ncoeff;
+    skipped += shards[t].skipped;
+  }
+  munmap((void *)map, st.st_size);
+  printf("Loaded %zu positions (%zu coefficients, %zu skipped) on %d threads in %.2fs\n", total, coeffs, skipped, n, gtime() - t0);
+  if (!total) {
+    free(shards);
+    return 0;
+  }
+
+  texel_fit_k(shards, n, total);
+  printf("K = %.6f, starting loss %.6f\n", K, texel_run(shards, n, total, 0, NULL));
+
+  static double grad[TW_COUNT][2], m[TW_COUNT][2], v[TW_COUNT][2];
+  const double b1 = 0.9, b2 = 0.999, eps = 1e-8;
+  double b1t = 1, b2t = 1;
+  int ok = 1;
+  t0 = gtime();
+  for (int epoch = 1; epoch <= opt->epochs && ok; ++epoch) {
+    double loss = texel_run(shards, n, total, 1, grad);
+    b1t *= b1;
+    b2t *= b2;
+    for (int i = 0; i < TW_COUNT; ++i) {
+      for (int h = 0; h < 2; ++h) {
+        double g = grad[i][h] * 2 * K / total;
+        m[i][h] = b1 * m[i][h] + (1 - b1) * g;
+        v[i][h] = b2 * v[i][h] + (1 - b2) * g * g;
+        weights[i][h] -= opt->lr * (m[i][h] / (1 - b1t)) / (sqrt(v[i][h] / (1 - b2t)) + eps);
+      }
+    }
+    if (epoch % TEXEL_REPORT == 0 || epoch == opt->epochs) {
+      printf("Epoch %d loss %.6f (%.2fs/epoch)\n", epoch, loss, (gtime() - t0) / epoch);
+      fflush(stdout);
+      ok = texel_save(&start, out); // checkpoint
+    }
+  }
+  if (ok) printf("Wrote %s\n", out);
+
+  for (int t = 0; t < n; ++t) {
+    free(shards[t].pos);
+    free(shards[t].coeffs);
+  }
+  free(shards);
+  return ok;
+}
@@ -1,46 +1,130 @@
 #include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "lib/tt.h"
 
-tt_table_t *g_tt = NULL;
+_Thread_local tt_table_t *g_tt = NULL; // one per search thread
+_Thread_local qtt_table_t *g_qtt = NULL;
+size_t tt_size_mb = TT_DEFAULT_SIZE_MB;
 
-tt_table_t *tt_create(size_t size_mb) {
-  tt_table_t *tt = malloc(sizeof(tt_table_t));
-  if (!tt) return NULL;
-  size_t num_bytes = size_mb * 1024 * 1024;
-  tt->num_buckets = num_bytes / sizeof(tt_bucket_t);
+typedef struct {
+  uint8_t *p;
+  size_t bytes;
+} tt_zero_arg_t;
+
+static void *tt_zero_worker(void *p) {
+  tt_zero_arg_t *a = p;
+  memset(a->p, 0, a->bytes);
+  return NULL;
+}
+
+static void tt_zero(void *p, size_t bytes) { // memset split across cores, also spreads first-touch page faults
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int n = cpus < 1 ? 1 : cpus > TT_CLEAR_THREADS ? TT_CLEAR_THREADS : (int)cpus;
+  if (n == 1 || bytes < (size_t)TT_CLEAR_PARALLEL_MB * 1024 * 1024) {
+    memset(p, 0, bytes);
+    return;
+  }
+
+  pthread_t threads[TT_CLEAR_THREADS];
+  tt_zero_arg_t args[TT_CLEAR_THREADS];
+  int started[TT_CLEAR_THREADS];
+  size_t chunk = (bytes / n) & ~(size_t)(TT_CACHE_LINE - 1);
+  for (int i = 0; i < n; ++i) {
+    args[i].p = (uint8_t *)p + chunk * i;
+    args[i].bytes = (i == n - 1) ? bytes - chunk * i : chunk;
+  }
+  for (int i = 1; i < n; ++i) // chunk 0 on the caller
+    started[i] = pthread_create(&threads[i], NULL, tt_zero_worker, &args[i]) == 0;
+  tt_zero_worker(&args[0]);
+  for (int i = 1; i < n; ++i) {
+    if (started[i]) pthread_join(threads[i], NULL);
+    else tt_zero_worker(&args[i]);
+  }
+}
 
-  uint64_t n = tt->num_buckets; // round down
+static uint64_t tt_num_buckets(size_t size_mb) { // largest 2^x buckets that fit
+  uint64_t n = (uint64_t)size_mb * 1024 * 1024 / sizeof(tt_bucket_t);
   n |= n >> 1;
   n |= n >> 2;
   n |= n >> 4;
   n |= n >> 8;
   n |= n >> 16;
   n |= n >> 32;
-  tt->num_buckets = (n + 1) >> 1;  // largest 2^x <= original
-  tt->mask = tt->num_buckets - 1;
-  tt->age = 0;
+  return (n + 1) >> 1;
+}
+
+static void *tt_alloc(size_t bytes, uint8_t *mapped) { // zeroed, cache line aligned, huge pages where available
+  *mapped = 0;
+#ifdef MAP_HUGETLB
+  if (bytes >= TT_HUGE_PAGE) { // reserved huge pages, fails unless the system has them
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      *mapped = 1;
+      return p;
+    }
+  }
+#endif
+  size_t align = bytes >= TT_HUGE_PAGE ? TT_HUGE_PAGE : TT_CACHE_LINE; // bytes is a power of 2 multiple of either
+  void *p = aligned_alloc(align, bytes);
+  if (!p) return NULL;
+#ifdef MADV_HUGEPAGE
+  if (bytes >= TT_HUGE_PAGE) madvise(p, bytes, MADV_HUGEPAGE); // transparent huge pages, before first touch
+#endif
+  tt_zero(p, bytes);
+  return p;
+}
 
-  tt->buckets = calloc(tt->num_buckets, sizeof(tt_bucket_t));
-  if (!tt->buckets) {
+tt_table_t *tt_create(size_t size_mb) {
+  tt_table_t *tt = malloc(sizeof(tt_table_t));
+  if (!tt) return NULL;
+  tt->buckets = NULL;
+  tt->num_buckets = 0;
+  tt->mapped = 0;
+  if (!tt_resize(tt, size_mb)) {
     free(tt);
     return NULL;
   }
+  return tt;
+}
+
+int tt_resize(tt_table_t *tt, size_t size_mb) {
+  if (!tt) return 0;
+  uint64_t n = tt_num_buckets(size_mb ? size_mb : 1);
+  uint8_t mapped;
+  tt_bucket_t *buckets = tt_alloc(n * sizeof(tt_bucket_t), &mapped);
+  if (!buckets) {
+    fprintf(stderr, "TT: failed to allocate %zu MB, keeping %llu buckets\n", size_mb, (unsigned long long)tt->num_buckets);
+    return 0;
+  }
+
+  if (tt->buckets) {
+    if (tt->mapped) munmap(tt->buckets, tt->num_buckets * sizeof(tt_bucket_t));
+    else free(tt->buckets);
+  }
+  tt->buckets = buckets;
+  tt->mapped = mapped;
+  tt->num_buckets = n;
+  tt->shift = (uint8_t)(64 - __builtin_ctzll(n)); // bucket index is the top log2(n) bits
+  tt->age = 0;
 
   size_t actual_mb = (tt->num_buckets * sizeof(tt_bucket_t)) / (1024 * 1024);
-  printf("TT: allocated %zu MB (%llu buckets, %d entries/bucket)\n", actual_mb, (unsigned long long)tt->num_buckets, TT_BUCKET_SIZE);
-  return tt;
+  printf("TT: allocated %zu MB (%llu buckets, %d entries/bucket%s)\n", actual_mb, (unsigned long long)tt->num_buckets, TT_BUCKET_SIZE, tt->mapped ? ", huge pages" : "");
+  return 1;
 }
 
 void tt_free(tt_table_t *tt) {
   if (tt) {
-    free(tt->buckets);
+    if (tt->mapped) munmap(tt->buckets, tt->num_buckets * sizeof(tt_bucket_t));
+    else free(tt->buckets);
     free(tt);
   }
 }
 
 void tt_clear(tt_table_t *tt) {
   if (tt && tt->buckets) {
-    memset(tt->buckets, 0, tt->num_buckets * sizeof(tt_bucket_t));
+    tt_zero(tt->buckets, tt->num_buckets * sizeof(tt_bucket_t));
     tt->age = 0;
   }
 }
@@ -51,22 +135,41 @@ void tt_new_search(tt_table_t *tt) {
   }
 }
 
+static inline uint64_t tt_pack(uint16_t move, int16_t score, int16_t eval, uint8_t depth, uint8_t flag) {
+  return (uint64_t)move | ((uint64_t)(uint16_t)score << 16) | ((uint64_t)(uint16_t)eval << 32) | ((uint64_t)depth << 48) | ((uint64_t)flag << 56);
+}
+
+static inline uint16_t tt_data_move(uint64_t d) { return (uint16_t)d; }
+static inline int16_t tt_data_score(uint64_t d) { return (int16_t)(uint16_t)(d >> 16); }
+static inline int16_t tt_data_eval(uint64_t d) { return (int16_t)(uint16_t)(d >> 32); }
+static inline uint8_t tt_data_depth(uint64_t d) { return (uint8_t)(d >> 48); }
+static inline uint8_t tt_data_flag(uint64_t d) { return (uint8_t)(d >> 56); }
+
+static inline void tt_read(const tt_entry_t *e, uint64_t *key, uint64_t *data) { // relaxed, 8-byte loads never tear
+  *data = __atomic_load_n(&e->data, __ATOMIC_RELAXED);
+  *key = __atomic_load_n(&e->key, __ATOMIC_RELAXED) ^ *data;
+}
+
+static inline void tt_write(tt_entry_t *e, uint64_t hash, uint64_t data) {
+  __atomic_store_n(&e->data, data, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->key, hash ^ data, __ATOMIC_RELAXED);
+}
+
 int tt_probe(tt_table_t *tt, uint64_t hash, int depth, int alpha, int beta, int *score, uint16_t *best_move, int ply) {
   if (!tt) return 0;
 
-  uint64_t idx = hash & tt->mask;
-  uint32_t key = (uint32_t)(hash >> 32);
-  tt_bucket_t *bucket = &tt->buckets[idx];
+  tt_bucket_t *bucket = tt_bucket(tt, hash);
 
   for (int i = 0; i < TT_BUCKET_SIZE; ++i) {
-    tt_entry_t *e = &bucket->entries[i];
+    uint64_t key, d;
+    tt_read(&bucket->entries[i], &key, &d);
 
-    if (e->key == key) {
-      *best_move = e->move; // found entry
+    if (key == hash && tt_data_flag(d) != TT_NONE) {
+      *best_move = tt_data_move(d); // found entry
 
-      if (e->depth >= depth) { // use score if depth sufficient
-        int s = tt_score_from_tt(e->score, ply);
-        tt_flag_t flag = (tt_flag_t)(e->flag & 0x3);
+      if (tt_data_depth(d) >= depth) { // use score if depth sufficient
+        int s = tt_score_from_tt(tt_data_score(d), ply);
+        tt_flag_t flag = (tt_flag_t)(tt_data_flag(d) & 0x3);
 
         switch (flag) {
           case TT_EXACT:
@@ -99,30 +202,31 @@ int tt_probe(tt_table_t *tt, uint64_t hash, int depth, int alpha, int beta, int
 void tt_store(tt_table_t *tt, uint64_t hash, int depth, int score, tt_flag_t flag, uint16_t best_move, int ply) {
   if (!tt) return;
 
-  uint64_t idx = hash & tt->mask;
-  uint32_t key = (uint32_t)(hash >> 32);
-  tt_bucket_t *bucket = &tt->buckets[idx];
+  tt_bucket_t *bucket = tt_bucket(tt, hash);
 
   tt_entry_t *replace = &bucket->entries[0]; // empty, same pos, best
   int replace_score = INT32_MAX;
 
   for (int i = 0; i < TT_BUCKET_SIZE; ++i) {
     tt_entry_t *e = &bucket->entries[i];
-    if (e->flag == TT_NONE) { // empty
+    uint64_t key, d;
+    tt_read(e, &key, &d);
+    uint8_t eflag = tt_data_flag(d);
+    if (eflag == TT_NONE) { // empty
       replace = e;
       break;
     }
-    if (e->key == key) { // same position
-      if (depth >= e->depth || (e->flag >> 2) != tt->age) {
+    if (key == hash) { // same position
+      if (depth >= tt_data_depth(d) || (eflag >> 2) != tt->age) {
         replace = e;
         break;
       }
       return;
     }
 
-    int entry_age = (e->flag >> 2); // upper 6 bits
+    int entry_age = (eflag >> 2); // upper 6 bits
     int age_diff = (tt->age - entry_age) & 0x3F;
-    int rs = e->depth - 4 * age_diff; 
+    int rs = tt_data_depth(d) - 4 * age_diff;
 
     if (rs < replace_score) {
       replace_score = rs;
@@ -130,26 +234,197 @@ void tt_store(tt_table_t *tt, uint64_t hash, int depth, int score, tt_flag_t fla
     }
   }
 
-  replace->key = key;
-  replace->score = (int16_t)tt_score_to_tt(score, ply);
-  replace->eval = 0;  // not used yet
-  replace->move = best_move;
-  replace->depth = (uint8_t)depth;
-  replace->flag = (uint8_t)(flag | (tt->age << 2));
+  // eval slot not used yet
+  tt_write(replace, hash, tt_pack(best_move, (int16_t)tt_score_to_tt(score, ply), 0, (uint8_t)depth, (uint8_t)(flag | (tt->age << 2))));
 }
 
 uint16_t tt_get_move(tt_table_t *tt, uint64_t hash) {
   if (!tt) return 0;
 
-  uint64_t idx = hash & tt->mask;
-  uint32_t key = (uint32_t)(hash >> 32);
-  tt_bucket_t *bucket = &tt->buckets[idx];
+  tt_bucket_t *bucket = tt_bucket(tt, hash);
 
   for (int i = 0; i < TT_BUCKET_SIZE; ++i) {
-    if (bucket->entries[i].key == key) {
-      return bucket->entries[i].move;
+    uint64_t key, d;
+    tt_read(&bucket->entries[i], &key, &d);
+    if (key == hash && tt_data_flag(d) != TT_NONE) {
+      return tt_data_move(d);
     }
   }
 
   return 0;
 }
+
+int tt_lookup(tt_table_t *tt, uint64_t hash, int *score, int *depth, tt_flag_t *flag, int ply) {
+  if (!tt) return 0;
+
+  tt_bucket_t *bucket = tt_bucket(tt, hash);
+
+  for (int i = 0; i < TT_BUCKET_SIZE; ++i) {
+    uint64_t key, d;
+    tt_read(&bucket->entries[i], &key, &d);
+    if (key == hash && tt_data_flag(d) != TT_NONE) {
+      *score = tt_score_from_tt(tt_data_score(d), ply);
+      *depth = tt_data_depth(d);
+      *flag = (tt_flag_t)(tt_data_flag(d) & 0x3);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+qtt_table_t *qtt_create(size_t size_kb) {
+  qtt_table_t *qtt = malloc(sizeof(qtt_table_t));
+  if (!qtt) return NULL;
+  uint64_t n = (uint64_t)size_kb * 1024 / sizeof(tt_entry_t);
+  n = n ? 1ULL << (63 - __builtin_clzll(n)) : 1; // round down to 2^x
+  qtt->entries = aligned_alloc(TT_CACHE_LINE, n * sizeof(tt_entry_t));
+  if (!qtt->entries) {
+    free(qtt);
+    return NULL;
+  }
+  memset(qtt->entries, 0, n * sizeof(tt_entry_t));
+  qtt->num_entries = n;
+  qtt->shift = (uint8_t)(64 - __builtin_ctzll(n));
+  return qtt;
+}
+
+void qtt_free(qtt_table_t *qtt) {
+  if (qtt) {
+    free(qtt->entries);
+    free(qtt);
+  }
+}
+
+void qtt_clear(qtt_table_t *qtt) {
+  if (qtt && qtt->entries) memset(qtt->entries, 0, qtt->num_entries * sizeof(tt_entry_t));
+}
+
+uint16_t qtt_get_move(qtt_table_t *qtt, uint64_t hash) {
+  if (!qtt || qtt->shift == 64) return 0;
+
+  uint64_t key, d;
+  tt_read(&qtt->entries[hash >> qtt->shift], &key, &d);
+  if (key != hash || tt_data_flag(d) == TT_NONE) return 0;
+  return tt_data_move(d);
+}
+
+int qtt_probe(qtt_table_t *qtt, uint64_t hash, int depth, int alpha, int beta, int *score, uint16_t *best_move, int *eval, int ply) {
+  *best_move = 0;
+  *eval = QTT_NO_EVAL;
+  if (!qtt || qtt->shift == 64) return 0;
+
+  uint64_t key, d;
+  tt_read(&qtt->entries[hash >> qtt->shift], &key, &d);
+  if (key != hash || tt_data_flag(d) == TT_NONE) return 0;
+
+  *best_move = tt_data_move(d);
+  *eval = tt_data_eval(d);
+  if (tt_data_depth(d) - QTT_DEPTH_OFFSET < depth) return 0;
+
+  int s = tt_score_from_tt(tt_data_score(d), ply);
+  switch ((tt_flag_t)(tt_data_flag(d) & 0x3)) {
+    case TT_EXACT:
+      *score = s;
+      return 1;
+    case TT_LOWER:
+      if (s >= beta) {
+        *score = s;
+        return 1;
+      }
+      return 0;
+    case TT_UPPER:
+      if (s <= alpha) {
+        *score = s;
+        return 1;
+      }
+      return 0;
+    default:
+      return 0;
+  }
+}
+
+void qtt_store(qtt_table_t *qtt, uint64_t hash, int depth, int score, tt_flag_t flag, uint16_t best_move, int eval, int ply) {
+  if (!qtt || qtt->shift == 64) return;
+  tt_write(&qtt->entries[hash >> qtt->shift], hash, tt_pack(best_move, (int16_t)tt_score_to_tt(score, ply), (int16_t)eval, (uint8_t)(depth + QTT_DEPTH_OFFSET), (uint8_t)flag));
+}
+
+int tt_hashfull(const tt_table_t *tt) {
+  if (!tt) return 0;
+  uint64_t n = tt->num_buckets < TT_HASHFULL_SAMPLE ? tt->num_buckets : TT_HASHFULL_SAMPLE;
+  int used = 0;
+  for (uint64_t b = 0; b < n; ++b) {
+    for (int i = 0; i < TT_BUCKET_SIZE; ++i) {
+      uint8_t flag = tt_data_flag(__atomic_load_n(&tt->buckets[b].entries[i].data, __ATOMIC_RELAXED));
+      if (flag != TT_NONE && (flag >> 2) == tt->age) ++used;
+    }
+  }
+  return (int)(used * 1000 / (n * TT_BUCKET_SIZE));
+}
+
+#define TT_STRESS_THREADS (8)
+#define TT_STRESS_OPS (4000000) // per thread
+#define TT_STRESS_KEYS (1 << 16) // distinct positions, far more than the table holds
+
+typedef struct {
+  tt_table_t *tt;
+  uint64_t seed;
+  long hits;
+  long corrupt;
+} tt_stress_arg_t;
+
+static inline uint64_t tt_stress_rand(uint64_t *s) { // xorshift64*
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 0x2545F4914F6CDD1DULL;
+}
+
+static inline uint64_t tt_stress_hash(uint64_t k) { // fixed hash per key, spread over buckets
+  return (k + 1) * 0x9e3779b97f4a7c15ULL;
+}
+
+static void *tt_stress_worker(void *p) {
+  tt_stress_arg_t *a = p;
+  for (long i = 0; i < TT_STRESS_OPS; ++i) {
+    uint64_t r = tt_stress_rand(&a->seed);
+    uint64_t hash = tt_stress_hash(r % TT_STRESS_KEYS);
+    uint16_t move = (uint16_t)(hash >> 20); // expected values are a function of the hash
+    int score = (int)((hash >> 40) % 20001) - 10000;
+    int depth = 1 + (int)((r >> 32) % 30);
+    if (r & (1ULL << 63)) {
+      tt_store(a->tt, hash, depth, score, TT_EXACT, move, 0);
+    } else {
+      int s = 0;
+      uint16_t m = 0;
+      if (tt_probe(a->tt, hash, 0, INT32_MIN, INT32_MAX, &s, &m, 0)) {
+        ++a->hits;
+        if (s != score || m != move) ++a->corrupt;
+      }
+    }
+  }
+  return NULL;
+}
+
+int tt_stress_test(void) {
+  tt_table_t *tt = tt_create(1); // small table, constant replacement and same-bucket races
+  if (!tt) {
+    fprintf(stderr, "Alloc failed\n");
+    exit(1);
+  }
+  pthread_t threads[TT_STRESS_THREADS];
+  tt_stress_arg_t args[TT_STRESS_THREADS];
+  for (int i = 0; i < TT_STRESS_THREADS; ++i) {
+    args[i] = (tt_stress_arg_t){ .tt = tt, .seed = 0x1234567ULL * (i + 1), .hits = 0, .corrupt = 0 };
+    pthread_create(&threads[i], NULL, tt_stress_worker, &args[i]);
+  }
+  long hits = 0, corrupt = 0;
+  for (int i = 0; i < TT_STRESS_THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+    hits += args[i].hits;
+    corrupt += args[i].corrupt;
+  }
+  printf("TT stress: %d threads, %ld ops, %ld hits, %ld corrupt -> %s\n", TT_STRESS_THREADS, (long)TT_STRESS_THREADS * TT_STRESS_OPS, hits, corrupt, corrupt ? "FAILED" : "passed");
+  tt_free(tt);
+  return corrupt == 0;
+}
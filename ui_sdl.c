@@ -9,6 +9,8 @@
 #include "lib/ui_sdl.h"
 #include "lib/utils.h"
 #include "lib/opening.h"
+#include "lib/nnue.h"
+#include "lib/experience.h"
 
 const char* TEX_PATHS[TEX_COUNT] = {
   "assets/wP.gif", "assets/wN.gif", "assets/wB.gif",
@@ -181,15 +183,23 @@ int run_sdl(void) {
 
   init_attack_tables();
   init_pesto_tables();
-  if (OPENING_BOOK)
-    init_opening_book();
-  if (!load_openings("high_elo_opening.csv")) {
+  if (OPENING_BOOK && !book_init(BOOK_FILE, BOOK_CSV)) {
     fprintf(stderr, "WARNING: failed to load opening book, continuing without it.\n");
   }
+  if (TT_ENABLED && !g_tt) // allocate and fault in the hash before the first move
+    g_tt = tt_create(tt_size_mb);
+  if (TT_ENABLED && !g_qtt)
+    g_qtt = qtt_create(QTT_SIZE_KB);
+  if (EXPERIENCE && !exp_open(EXPERIENCE_FILE))
+    fprintf(stderr, "WARNING: failed to open experience file, continuing without it.\n");
 #ifdef DEBUG
   printf("Initialized attack & pesto tables and opening book.\n");
 #endif
   board* B = init_board();
+  if (NNUE_EVAL) {
+    if (nnue_load(NNUE_FILE)) nnue_attach(B);
+    else fprintf(stderr, "WARNING: failed to load NNUE, using blended eval.\n");
+  }
   // test_position(B, "3q1rk1/2ppbppp/1p6/1N2Qp2/1P6/3B4/rB1P1PPP/n2K2NR b K - 0 1"); // for testing hardcoded positions
   // test_position(B, "3q1rk1/2pp1ppp/1p3b2/1N3Q2/1P6/3B4/rB1P1PPP/n2K2NR b - - 0 2"); // for testing hardcoded positions
   // test_position(B, "k7/1p6/8/8/4KP2/8/8/8 w - - 0 1"); // for testing hardcoded positions
@@ -211,9 +221,9 @@ int run_sdl(void) {
       int type = -1;
 
       if (OPENING_BOOK) {
-        open_node *book_node = get_book_move(move_history, history_len);
-        if (book_node && book_node->move_code >= 0) {
-          best = book_node->move_code;
+        int code = book_move(B, move_history, history_len);
+        if (code >= 0) {
+          best = code;
           from = best / 64;
           to = best % 64;
           type = 0; // opening book
@@ -265,9 +275,9 @@ int run_sdl(void) {
       int type = -1;
 
       if (OPENING_BOOK) {
-        open_node *book_node = get_book_move(move_history, history_len);
-        if (book_node && book_node->move_code >= 0) {
-          best = book_node->move_code;
+        int code = book_move(B, move_history, history_len);
+        if (code >= 0) {
+          best = code;
           from = best / 64;
           to = best % 64;
           type = 0; // opening book